@@ -0,0 +1,262 @@
+/*
+ *    Copyright 2012 Peter Curtis
+ *
+ *    This file is part of libocad.
+ *
+ *    libocad is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libocad is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libocad.h"
+
+/* Curve fitting after Philip J. Schneider, "An Algorithm for Automatically Fitting Digitized
+ * Curves" (Graphics Gems, 1990): a run of points is approximated by one cubic Bezier curve with
+ * given end tangents, found by least squares over a chord length parametrization. If the curve
+ * misses a point by more than the tolerance, the parameters are improved by Newton iteration a
+ * few times, and if that doesn't help either, the run is split at the worst point and both halves
+ * are fitted on their own, with a common tangent at the split point so the curve stays smooth.
+ */
+
+#define OCAD_FIT_ITERATIONS 4
+
+/** The largest coordinate an OCADPoint can hold.
+ */
+#define OCAD_FIT_MAX_COORD 0x7FFFFF
+
+typedef struct _OCADFitVector {
+	double x, y;
+} OCADFitVector;
+
+static OCADFitVector ocad_fit_point(const OCADPoint *pt) {
+	OCADFitVector v;
+	v.x = pt->x >> 8;
+	v.y = pt->y >> 8;
+	return v;
+}
+
+static OCADFitVector ocad_fit_normalize(double x, double y) {
+	OCADFitVector v;
+	double len = sqrt(x * x + y * y);
+	v.x = len > 0 ? x / len : 0;
+	v.y = len > 0 ? y / len : 0;
+	return v;
+}
+
+/** Returns the tangent at point i pointing towards increasing indices: along the path at the
+ *  run ends first and last, and along the chord of its neighbours in between.
+ */
+static OCADFitVector ocad_fit_tangent(const OCADPoint *pts, u32 i, u32 first, u32 last) {
+	OCADFitVector a = ocad_fit_point(&pts[i > first ? i - 1 : i]);
+	OCADFitVector b = ocad_fit_point(&pts[i < last ? i + 1 : i]);
+	return ocad_fit_normalize(b.x - a.x, b.y - a.y);
+}
+
+/** Evaluates the cubic Bezier curve with control points c at t.
+ */
+static OCADFitVector ocad_fit_eval(const OCADFitVector *c, double t) {
+	OCADFitVector v;
+	double s = 1 - t;
+	double b0 = s * s * s, b1 = 3 * s * s * t, b2 = 3 * s * t * t, b3 = t * t * t;
+	v.x = b0 * c[0].x + b1 * c[1].x + b2 * c[2].x + b3 * c[3].x;
+	v.y = b0 * c[0].y + b1 * c[1].y + b2 * c[2].y + b3 * c[3].y;
+	return v;
+}
+
+/** One Newton step for the parameter t of the point p on the curve c, minimizing the distance
+ *  between p and the curve.
+ */
+static double ocad_fit_newton(const OCADFitVector *c, OCADFitVector p, double t) {
+	OCADFitVector q = ocad_fit_eval(c, t), d1, d2;
+	double s = 1 - t, num, den;
+	d1.x = 3 * (s * s * (c[1].x - c[0].x) + 2 * s * t * (c[2].x - c[1].x) + t * t * (c[3].x - c[2].x));
+	d1.y = 3 * (s * s * (c[1].y - c[0].y) + 2 * s * t * (c[2].y - c[1].y) + t * t * (c[3].y - c[2].y));
+	d2.x = 6 * (s * (c[2].x - 2 * c[1].x + c[0].x) + t * (c[3].x - 2 * c[2].x + c[1].x));
+	d2.y = 6 * (s * (c[2].y - 2 * c[1].y + c[0].y) + t * (c[3].y - 2 * c[2].y + c[1].y));
+	num = (q.x - p.x) * d1.x + (q.y - p.y) * d1.y;
+	den = d1.x * d1.x + d1.y * d1.y + (q.x - p.x) * d2.x + (q.y - p.y) * d2.y;
+	if (den == 0) return t;
+	t -= num / den;
+	return t < 0 ? 0 : (t > 1 ? 1 : t);
+}
+
+/** Finds the inner control points of the curve from pts[first] to pts[last] with the end
+ *  tangents t1 and t2 (t2 pointing back along the path) by least squares at the parameters u,
+ *  and rounds them to map units.
+ */
+static void ocad_fit_generate(const OCADPoint *pts, u32 first, u32 last, const double *u,
+		OCADFitVector t1, OCADFitVector t2, OCADFitVector *c) {
+	double c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0, det, a1, a2, len;
+	u32 i;
+	c[0] = ocad_fit_point(&pts[first]);
+	c[3] = ocad_fit_point(&pts[last]);
+	for (i = first; i <= last; i++) {
+		double t = u[i], s = 1 - t;
+		double b0 = s * s * s, b1 = 3 * s * s * t, b2 = 3 * s * t * t, b3 = t * t * t;
+		OCADFitVector p = ocad_fit_point(&pts[i]);
+		double ax = t1.x * b1, ay = t1.y * b1, bx = t2.x * b2, by = t2.y * b2;
+		double rx = p.x - (b0 + b1) * c[0].x - (b2 + b3) * c[3].x;
+		double ry = p.y - (b0 + b1) * c[0].y - (b2 + b3) * c[3].y;
+		c00 += ax * ax + ay * ay;
+		c01 += ax * bx + ay * by;
+		c11 += bx * bx + by * by;
+		x0 += ax * rx + ay * ry;
+		x1 += bx * rx + by * ry;
+	}
+	det = c00 * c11 - c01 * c01;
+	a1 = det != 0 ? (x0 * c11 - x1 * c01) / det : 0;
+	a2 = det != 0 ? (c00 * x1 - c01 * x0) / det : 0;
+
+	// Without a usable solution, fall back to a third of the chord along the tangents
+	len = sqrt((c[3].x - c[0].x) * (c[3].x - c[0].x) + (c[3].y - c[0].y) * (c[3].y - c[0].y));
+	if (a1 < 1e-6 * len || a2 < 1e-6 * len || a1 > 2 * len || a2 > 2 * len) a1 = a2 = len / 3;
+	c[1].x = floor(c[0].x + a1 * t1.x + 0.5);
+	c[1].y = floor(c[0].y + a1 * t1.y + 0.5);
+	c[2].x = floor(c[3].x + a2 * t2.x + 0.5);
+	c[2].y = floor(c[3].y + a2 * t2.y + 0.5);
+	for (i = 1; i <= 2; i++) {
+		if (fabs(c[i].x) > OCAD_FIT_MAX_COORD) c[i].x = c[i].x < 0 ? -OCAD_FIT_MAX_COORD : OCAD_FIT_MAX_COORD;
+		if (fabs(c[i].y) > OCAD_FIT_MAX_COORD) c[i].y = c[i].y < 0 ? -OCAD_FIT_MAX_COORD : OCAD_FIT_MAX_COORD;
+	}
+}
+
+/** Returns the largest squared distance between the points and the curve at their parameters,
+ *  and the index of the point where it is reached in *worst.
+ */
+static double ocad_fit_error(const OCADPoint *pts, u32 first, u32 last, const double *u, const OCADFitVector *c, u32 *worst) {
+	double dmax = 0;
+	u32 i;
+	*worst = (first + last) / 2;
+	for (i = first + 1; i < last; i++) {
+		OCADFitVector p = ocad_fit_point(&pts[i]), q = ocad_fit_eval(c, u[i]);
+		double d = (q.x - p.x) * (q.x - p.x) + (q.y - p.y) * (q.y - p.y);
+		if (d > dmax) { dmax = d; *worst = i; }
+	}
+	return dmax;
+}
+
+/** Returns TRUE if all points between first and last are at most tol away from their chord.
+ */
+static bool ocad_fit_is_straight(const OCADPoint *pts, u32 first, u32 last, double tol) {
+	OCADFitVector a = ocad_fit_point(&pts[first]), b = ocad_fit_point(&pts[last]);
+	double dx = b.x - a.x, dy = b.y - a.y, len2 = dx * dx + dy * dy;
+	u32 i;
+	for (i = first + 1; i < last; i++) {
+		OCADFitVector p = ocad_fit_point(&pts[i]);
+		double px = p.x - a.x, py = p.y - a.y, d;
+		if (len2 > 0) { d = px * dy - py * dx; d = d * d / len2; }
+		else d = px * px + py * py;
+		if (d > tol * tol) return FALSE;
+	}
+	return TRUE;
+}
+
+/** Fits the plain points from pts[a] to pts[b] and appends the result after pts[a] (which is not
+ *  written) to opts. Returns the number of points written, which is at most b - a. The stack
+ *  needs room for 2 * (b - a) entries, and u for the indices a to b.
+ */
+static u32 ocad_fit_run(const OCADPoint *pts, u32 a, u32 b, double tol, double *u, u32 *stack, OCADPoint *opts) {
+	u32 sp = 0, n = 0;
+	stack[sp++] = b; stack[sp++] = a;
+	while (sp > 0) {
+		u32 first = stack[--sp], last = stack[--sp], i, worst = first + 1;
+		OCADFitVector t1, t2, c[4];
+		double err = 0;
+		int iter;
+
+		if (last - first <= 1 || ocad_fit_is_straight(pts, first, last, tol)) {
+			opts[n++] = pts[last];
+			continue;
+		}
+		if (last - first >= 3) {
+			// A curve takes three points, so it is only tried where it replaces at least as many
+			u[first] = 0;
+			for (i = first + 1; i <= last; i++) {
+				OCADFitVector p = ocad_fit_point(&pts[i - 1]), q = ocad_fit_point(&pts[i]);
+				u[i] = u[i - 1] + sqrt((q.x - p.x) * (q.x - p.x) + (q.y - p.y) * (q.y - p.y));
+			}
+			if (u[last] > 0) for (i = first + 1; i <= last; i++) u[i] /= u[last];
+			t1 = ocad_fit_tangent(pts, first, a, b);
+			t2 = ocad_fit_tangent(pts, last, a, b);
+			t2.x = -t2.x; t2.y = -t2.y;
+
+			for (iter = 0; iter <= OCAD_FIT_ITERATIONS; iter++) {
+				ocad_fit_generate(pts, first, last, u, t1, t2, c);
+				err = ocad_fit_error(pts, first, last, u, c, &worst);
+				if (err <= tol * tol || err > 16 * tol * tol) break;
+				for (i = first + 1; i < last; i++) u[i] = ocad_fit_newton(c, ocad_fit_point(&pts[i]), u[i]);
+			}
+			if (err <= tol * tol) {
+				opts[n].x = ((s32)c[1].x << 8) | PX_CTL1; opts[n].y = (s32)c[1].y << 8; n++;
+				opts[n].x = ((s32)c[2].x << 8) | PX_CTL2; opts[n].y = (s32)c[2].y << 8; n++;
+				opts[n++] = pts[last];
+				continue;
+			}
+		}
+		// Split at the worst point; the right half is pushed first, so the left one comes out first
+		if (worst <= first) worst = first + 1;
+		if (worst >= last) worst = last - 1;
+		stack[sp++] = last; stack[sp++] = worst;
+		stack[sp++] = worst; stack[sp++] = first;
+	}
+	return n;
+}
+
+/** Returns TRUE if the point i must stay where it is: the ends of the path and of its rings,
+ *  points with flags, and the ends of curves which are already in the path.
+ */
+static bool ocad_fit_is_anchor(const OCADPoint *pts, u32 npts, u32 i) {
+	if (i == 0 || i + 1 == npts) return TRUE;
+	if ((pts[i].x & 0xff) || (pts[i].y & 0xff)) return TRUE;
+	if ((pts[i - 1].x | pts[i + 1].x) & (PX_CTL1 | PX_CTL2)) return TRUE;
+	if (pts[i + 1].y & PY_HOLE) return TRUE;
+	return FALSE;
+}
+
+u32 ocad_path_fit_curves(const OCADPoint *pts, u32 npts, s32 tolerance, OCADPoint *opts) {
+	double u_buf[256];
+	u32 stack_buf[512];
+	double *u = u_buf;
+	u32 *stack = stack_buf;
+	u32 i, a, n;
+
+	if (tolerance <= 0 || npts < 4) {
+		memcpy(opts, pts, npts * sizeof(OCADPoint));
+		return npts;
+	}
+	if (npts > 256) {
+		u = (double *)malloc(npts * sizeof(double));
+		stack = (u32 *)malloc(2 * npts * sizeof(u32));
+		if (u == NULL || stack == NULL) {
+			free(u); free(stack);
+			memcpy(opts, pts, npts * sizeof(OCADPoint));
+			return npts;
+		}
+	}
+
+	opts[0] = pts[0];
+	n = 1;
+	for (i = 1, a = 0; i < npts; i++) {
+		if (!ocad_fit_is_anchor(pts, npts, i)) continue;
+		if (i == a + 1) opts[n++] = pts[i];
+		else n += ocad_fit_run(pts, a, i, tolerance, u, stack, opts + n);
+		a = i;
+	}
+
+	if (u != u_buf) free(u);
+	if (stack != stack_buf) free(stack);
+	return n;
+}
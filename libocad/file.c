@@ -25,100 +25,389 @@
 #include <sys/stat.h>
 #ifndef _MSC_VER
 #include <unistd.h>
+#else
+#include <io.h>
+#endif
+#if defined(_WIN32)
+#include <windows.h>
+#define OCAD_VIRTUAL_BUFFER
+#define OCAD_THREADS
+#elif defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sys/mman.h>
+#define OCAD_VIRTUAL_BUFFER
+#define OCAD_MMAP_FILES
+#define OCAD_THREADS
 #endif
 
 #include "libocad.h"
 
-/** Structure for compacting entity indexes - used in the compaction callback functions.
+// Address space reserved for virtual buffers: the largest file with 32 bit offsets on 64 bit
+// systems. On 32 bit systems the scarce address space only allows room for growth around the
+// expected size, between these limits.
+#define OCAD_VIRTUAL_RESERVE_MAX (sizeof(void *) >= 8 ? 0xFFFF0000u : 0x20000000u)
+#define OCAD_VIRTUAL_RESERVE_MIN 0x1000000u
+// Virtual buffers are committed in multiples of this size
+#define OCAD_COMMIT_GRANULARITY 0x10000u
+
+/** One section of entities while a file is compacted: the live index entries, copied out of the
+ *  old index blocks, and the new location of their data and of the index blocks.
  */
-typedef struct _IndexBuilder {
-	u8 *p;			// Pointer where we can start writing data
-	u8 *base;		// Pointer to base of memory block (base - p is used for offsets)
-	dword *pfirst;	// Pointer to location of first index block offset
-	void *idx;		// Pointer to the current index block, starts out as NULL
-	int i;			// Index of the last object written to the index block, starts out as 0
-} IndexBuilder;
-
-/** Copies src to dest, advances the destination pointer to a dword alignment, and returns
- *  the new value of the destination pointer.
+typedef struct _OCADCompactSection {
+	u32 count;			// Number of live entries
+	u32 capacity;		// Number of entries the arrays have room for
+	u32 entry_size;		// Size of an index entry
+	u32 ptr_offset;		// Offset of the data pointer within an index entry
+	u8 *entries;		// Copies of the live entries, still with their old data pointers
+	u32 *sizes;			// Sizes of the data
+	dword *offsets;		// New offsets of the data
+	dword *blocks;		// New offsets of the index blocks
+	u32 nblocks;		// Number of index blocks, at least one
+} OCADCompactSection;
+
+/** Everything the workers need to move a section.
  */
-static u8 *copy_and_advance(u8 *dest, const void *src, u32 size) {
-	u64 tmp;
-	u8 *end;
-	if (src != NULL) memcpy(dest, src, size);
-	// align to dword
-	tmp = (u64)dest + size + (4 - 1);
-	tmp -= tmp % 4;
-	end = (u8 *)tmp;
-	if (src == NULL) size = 0;
-	memset(dest + size, 0, (end - (dest + size)));
-	return (u8 *)tmp;
-}
-
-static bool ocad_file_compact_symbol_cb(void *param, OCADFile *pfile, OCADSymbol *symbol) {
-	OCADSymbolEntry *entry;
-	IndexBuilder *b = (IndexBuilder *)param;
-	OCADSymbolIndex *idx = (OCADSymbolIndex *)b->idx;
-	if (++b->i == 256) {
-		u8 *next = b->p;
-		b->p = copy_and_advance(b->p, NULL, sizeof(OCADSymbolIndex));
-		if (idx) idx->next = (next - b->base); else *(b->pfirst) = (next - b->base);
-		b->idx = next; b->i = 0;
-		idx = (OCADSymbolIndex *)b->idx;
-	}
-	entry = &(idx->entry[b->i]);
-
-	entry->ptr = (b->p - b->base);
-
-	b->p = copy_and_advance(b->p, symbol, symbol->size);
-	return TRUE;
+typedef struct _OCADCompactJob {
+	OCADFile *pfile;
+	const u8 *src;		// Buffer the data is moved from
+	u8 *dest;			// Buffer the data is moved to, may be the same as src
+	OCADCompactSection *section;
+	dword end;			// New size of the file
+	bool refresh;		// Recalculate all object rectangles, not only invalid ones
+} OCADCompactJob;
+
+typedef void (*OCADWorkerFunc)(void *param, u32 worker, u32 nworkers);
+
+#ifdef OCAD_THREADS
+typedef struct _OCADWorker {
+	OCADWorkerFunc func;
+	void *param;
+	u32 worker, nworkers;
+} OCADWorker;
+
+#if defined(_WIN32)
+static DWORD WINAPI ocad_worker_main(LPVOID arg) {
+	OCADWorker *w = (OCADWorker *)arg;
+	w->func(w->param, w->worker, w->nworkers);
+	return 0;
+}
+#else
+static void *ocad_worker_main(void *arg) {
+	OCADWorker *w = (OCADWorker *)arg;
+	w->func(w->param, w->worker, w->nworkers);
+	return NULL;
+}
+#endif
+#endif
+
+/** Returns the number of processors, or 1 if it is unknown.
+ */
+static u32 ocad_processor_count(void) {
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (u32)n : 1;
+#else
+	return 1;
+#endif
 }
 
-static bool ocad_file_compact_object_entry_cb(void *param, OCADFile *pfile, OCADObjectEntry *entry) {
-	OCADObjectEntry *enew;
-	OCADObject *object;
-	IndexBuilder *b = (IndexBuilder *)param;
-	OCADObjectIndex *idx = (OCADObjectIndex *)b->idx;
-	if (++b->i == 256) {
-		u8 *next = b->p;
-		b->p = copy_and_advance(b->p, NULL, sizeof(OCADObjectIndex));
-		if (idx) idx->next = (next - b->base); else *(b->pfirst) = (next - b->base);
-		b->idx = next; b->i = 0;
-		idx = (OCADObjectIndex *)b->idx;
+/** Calls func for the workers 0 .. nworkers - 1, each on its own thread, and waits until all of
+ *  them are done. Workers whose thread can't be started run on the calling thread instead.
+ */
+static void ocad_run_workers(u32 nworkers, OCADWorkerFunc func, void *param) {
+#ifdef OCAD_THREADS
+	OCADWorker *workers = NULL;
+	u32 i;
+#if defined(_WIN32)
+	HANDLE *threads = NULL;
+#else
+	pthread_t *threads = NULL;
+	bool *started = NULL;
+#endif
+	if (nworkers > 1) {
+		workers = (OCADWorker *)malloc(nworkers * sizeof(OCADWorker));
+#if defined(_WIN32)
+		threads = (HANDLE *)calloc(nworkers, sizeof(HANDLE));
+#else
+		threads = (pthread_t *)malloc(nworkers * sizeof(pthread_t));
+		started = (bool *)calloc(nworkers, sizeof(bool));
+		if (started == NULL) { free(threads); threads = NULL; }
+#endif
 	}
-	enew = &(idx->entry[b->i]);
-	object = ocad_object(pfile, entry);
+	if (workers == NULL || threads == NULL) {
+		free(workers); free(threads);
+		for (i = 0; i < nworkers; i++) func(param, i, nworkers);
+		return;
+	}
+	// Worker 0 runs on the calling thread
+	for (i = 1; i < nworkers; i++) {
+		workers[i].func = func; workers[i].param = param;
+		workers[i].worker = i; workers[i].nworkers = nworkers;
+#if defined(_WIN32)
+		threads[i] = CreateThread(NULL, 0, ocad_worker_main, &workers[i], 0, NULL);
+		if (threads[i] == NULL) func(param, i, nworkers);
+#else
+		started[i] = (pthread_create(&threads[i], NULL, ocad_worker_main, &workers[i]) == 0);
+		if (!started[i]) func(param, i, nworkers);
+#endif
+	}
+	func(param, 0, nworkers);
+	for (i = 1; i < nworkers; i++) {
+#if defined(_WIN32)
+		if (threads[i] != NULL) { WaitForSingleObject(threads[i], INFINITE); CloseHandle(threads[i]); }
+#else
+		if (started[i]) pthread_join(threads[i], NULL);
+#endif
+	}
+#if !defined(_WIN32)
+	free(started);
+#endif
+	free(threads);
+	free(workers);
+#else
+	u32 i;
+	for (i = 0; i < nworkers; i++) func(param, i, nworkers);
+#endif
+}
 
-	enew->ptr = (b->p - b->base);
-	enew->npts = object->npts + object->ntext;
-	ocad_object_entry_refresh(pfile, enew, object);
+/** Appends a copy of an index entry with the given data size to a section. Returns FALSE if
+ *  there is not enough memory.
+ */
+static bool ocad_compact_add(OCADCompactSection *section, const void *entry, u32 size) {
+	if (section->count == section->capacity) {
+		u32 capacity = section->capacity ? section->capacity * 2 : 256;
+		u8 *entries = (u8 *)realloc(section->entries, (size_t)capacity * section->entry_size);
+		u32 *sizes;
+		if (entries == NULL) return FALSE;
+		section->entries = entries;
+		sizes = (u32 *)realloc(section->sizes, capacity * sizeof(u32));
+		if (sizes == NULL) return FALSE;
+		section->sizes = sizes;
+		section->capacity = capacity;
+	}
+	memcpy(section->entries + (size_t)section->count * section->entry_size, entry, section->entry_size);
+	section->sizes[section->count++] = size;
+	return TRUE;
+}
 
-	b->p = copy_and_advance(b->p, object, ocad_object_size(object));
+static bool ocad_compact_symbol_cb(void *param, OCADFile *pfile, OCADSymbol *symbol) {
+	OCADSymbolEntry entry;
+	entry.ptr = ocad_file_offset(pfile, symbol);
+	return ocad_compact_add((OCADCompactSection *)param, &entry, symbol->size);
+}
+
+static bool ocad_compact_object_cb(void *param, OCADFile *pfile, OCADObjectEntry *entry) {
+	return ocad_compact_add((OCADCompactSection *)param, entry, ocad_object_size(ocad_object(pfile, entry)));
+}
+
+static bool ocad_compact_string_cb(void *param, OCADFile *pfile, OCADStringEntry *entry) {
+	return ocad_compact_add((OCADCompactSection *)param, entry, entry->size);
+}
+
+static void ocad_compact_free(OCADCompactSection *section) {
+	free(section->entries);
+	free(section->sizes);
+	free(section->offsets);
+	free(section->blocks);
+}
+
+static dword ocad_compact_align(dword offs) {
+	return (offs + 3) & ~(dword)3;
+}
+
+static dword ocad_compact_old_ptr(const OCADCompactSection *section, u32 i) {
+	dword ptr;
+	memcpy(&ptr, section->entries + (size_t)i * section->entry_size + section->ptr_offset, sizeof(dword));
+	return ptr;
+}
+
+/** Lays out a section starting at offset p: each index block is followed by the data of its
+ *  entries, each of them aligned to a dword. The new offsets are the running sum of the sizes.
+ *  Returns the offset behind the section, or 0 if there is not enough memory or the file would
+ *  grow beyond 4 GiB.
+ */
+static dword ocad_compact_layout(OCADCompactSection *section, dword p) {
+	u64 offs = p;
+	u32 i, block_size = 4 + 256 * section->entry_size;
+	section->nblocks = section->count > 0 ? (section->count + 255) / 256 : 1;
+	section->offsets = (dword *)malloc((section->count + 1) * sizeof(dword));
+	section->blocks = (dword *)malloc(section->nblocks * sizeof(dword));
+	if (section->offsets == NULL || section->blocks == NULL) return 0;
+	offs = ocad_compact_align(p);
+	if (section->count == 0) {
+		section->blocks[0] = (dword)offs;
+		offs += block_size;
+	}
+	for (i = 0; i < section->count; i++) {
+		if (i % 256 == 0) {
+			section->blocks[i / 256] = (dword)ocad_compact_align((dword)offs);
+			offs = section->blocks[i / 256] + block_size;
+		}
+		section->offsets[i] = ocad_compact_align((dword)offs);
+		offs = (u64)section->offsets[i] + section->sizes[i];
+		if (offs > 0xFFFF0000u) return 0;
+	}
+	return (dword)offs;
+}
+
+/** Checks the moves of a section for compaction in place: the data must come in the order of
+ *  the old file, and nothing may be written over data which hasn't been moved yet. written is
+ *  the end of what has been written before, and read the end of the data read so far.
+ */
+static bool ocad_compact_check(const OCADCompactSection *section, dword *written, dword *read) {
+	u32 i, block_size = 4 + 256 * section->entry_size;
+	if (section->count == 0) { *written = section->blocks[0] + block_size; return TRUE; }
+	for (i = 0; i < section->count; i++) {
+		dword src = ocad_compact_old_ptr(section, i);
+		if (i % 256 == 0) *written = section->blocks[i / 256] + block_size;
+		if (src < *read || *written > src || section->offsets[i] > src) return FALSE;
+		*written = section->offsets[i] + ocad_compact_align(section->sizes[i]);
+		*read = src + section->sizes[i];
+	}
 	return TRUE;
 }
 
-static bool ocad_file_compact_string_entry_cb(void *param, OCADFile *pfile, OCADStringEntry *entry) {
-	IndexBuilder *b = (IndexBuilder *)param;
-	OCADStringIndex *idx = (OCADStringIndex *)b->idx;
-	OCADStringEntry *enew;
-	OCADCString *str;
-	if (++b->i == 256) {
-		u8 *next = b->p;
-		b->p = copy_and_advance(b->p, NULL, sizeof(OCADStringIndex));
-		if (idx) idx->next = (next - b->base); else *(b->pfirst) = (next - b->base);
-		b->idx = next; b->i = 0;
-		idx = (OCADStringIndex *)b->idx;
+/** Writes the index blocks first .. last - 1 of a section into dest and moves their data there.
+ */
+static void ocad_compact_move(const OCADCompactJob *job, u32 first, u32 last) {
+	const OCADCompactSection *section = job->section;
+	u32 b, i, block_size = 4 + 256 * section->entry_size;
+	for (b = first; b < last; b++) {
+		u8 *block = job->dest + section->blocks[b];
+		dword next = (b + 1 < section->nblocks) ? section->blocks[b + 1] : 0;
+		memset(block, 0, block_size);
+		memcpy(block, &next, sizeof(dword));
+		for (i = b * 256; i < section->count && i < (b + 1) * 256; i++) {
+			u8 *entry = block + 4 + (i % 256) * section->entry_size;
+			dword offs = section->offsets[i];
+			u32 size = section->sizes[i];
+			u32 pad = ocad_compact_align(offs + size) - (offs + size);
+			memcpy(entry, section->entries + (size_t)i * section->entry_size, section->entry_size);
+			memcpy(entry + section->ptr_offset, &offs, sizeof(dword));
+			memmove(job->dest + offs, job->src + ocad_compact_old_ptr(section, i), size);
+			// the padding up to the next entity, which is left out behind the last one
+			if (offs + size + pad <= job->end) memset(job->dest + offs + size, 0, pad);
+		}
 	}
-	enew = &(idx->entry[b->i]);
-	str = ocad_string(pfile, entry);
+}
 
-	// Write a new index entry
-	enew->ptr = (b->p - b->base);
-	enew->size = entry->size;
-	enew->type = entry->type;
+static void ocad_compact_move_worker(void *param, u32 worker, u32 nworkers) {
+	const OCADCompactJob *job = (const OCADCompactJob *)param;
+	u32 nblocks = job->section->nblocks;
+	ocad_compact_move(job, (u32)((u64)nblocks * worker / nworkers), (u32)((u64)nblocks * (worker + 1) / nworkers));
+}
 
-	b->p = copy_and_advance(b->p, str, entry->size);
-	return TRUE;
+/** Updates the point counts of the moved objects, and their rectangles if these are invalid or
+ *  a refresh was requested.
+ */
+static void ocad_compact_refresh_worker(void *param, u32 worker, u32 nworkers) {
+	const OCADCompactJob *job = (const OCADCompactJob *)param;
+	const OCADCompactSection *section = job->section;
+	u32 i, first = (u32)((u64)section->count * worker / nworkers), last = (u32)((u64)section->count * (worker + 1) / nworkers);
+	for (i = first; i < last; i++) {
+		OCADObjectIndex *idx = (OCADObjectIndex *)(job->dest + section->blocks[i / 256]);
+		OCADObjectEntry *entry = &idx->entry[i % 256];
+		OCADObject *object = (OCADObject *)(job->dest + entry->ptr);
+		OCADRect *r = &entry->rect;
+		entry->npts = object->npts + object->ntext;
+		if (job->refresh || r->min.x > r->max.x || r->min.y > r->max.y) ocad_object_entry_refresh(job->pfile, entry, object);
+	}
+}
+
+
+/** Reserves a range of address space without committing memory for it. Returns NULL if
+ *  virtual buffers are not supported, or if the range can't be reserved.
+ */
+static u8 *ocad_buffer_reserve(u32 range) {
+#if defined(_WIN32)
+	return (u8 *)VirtualAlloc(NULL, range, MEM_RESERVE, PAGE_NOACCESS);
+#elif defined(OCAD_VIRTUAL_BUFFER)
+	void *p = mmap(NULL, range, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (p == MAP_FAILED) ? NULL : (u8 *)p;
+#else
+	return NULL;
+#endif
+}
+
+/** Commits the memory between the given offsets in a reserved range. The new memory is zero.
+ *  Returns FALSE if the system is out of memory.
+ */
+static bool ocad_buffer_commit(u8 *buffer, u32 from, u32 to) {
+	if (to <= from) return TRUE;
+#if defined(_WIN32)
+	return VirtualAlloc(buffer + from, to - from, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#elif defined(OCAD_VIRTUAL_BUFFER)
+	return mprotect(buffer + from, to - from, PROT_READ | PROT_WRITE) == 0;
+#else
+	return FALSE;
+#endif
+}
+
+/** Releases a range of address space reserved by ocad_buffer_reserve().
+ */
+static void ocad_buffer_release(u8 *buffer, u32 range) {
+#if defined(_WIN32)
+	VirtualFree(buffer, 0, MEM_RELEASE);
+#elif defined(OCAD_VIRTUAL_BUFFER)
+	munmap(buffer, range);
+#endif
+}
+
+/** Frees the buffer of a file, according to the way it was allocated.
+ */
+static void ocad_file_free_buffer(OCADFile *pfile) {
+	if (pfile->buffer == NULL) return;
+	if (pfile->storage == OCAD_STORAGE_VIRTUAL) ocad_buffer_release(pfile->buffer, pfile->virtual_size);
+#ifdef OCAD_MMAP_FILES
+	else if (pfile->storage == OCAD_STORAGE_MAPPED) munmap(pfile->buffer, pfile->virtual_size);
+#endif
+	else free(pfile->buffer);
+	pfile->buffer = NULL;
+}
+
+/** Returns the address space to reserve for a virtual buffer which starts with the given size.
+ */
+static u32 ocad_buffer_range(u32 size) {
+	u64 range;
+	if (sizeof(void *) >= 8) return OCAD_VIRTUAL_RESERVE_MAX;
+	// Room for the file to double; beyond that it continues on the heap
+	range = 2 * (u64)size;
+	if (range < OCAD_VIRTUAL_RESERVE_MIN) range = OCAD_VIRTUAL_RESERVE_MIN;
+	if (range > OCAD_VIRTUAL_RESERVE_MAX) range = OCAD_VIRTUAL_RESERVE_MAX;
+	return (u32)((range + OCAD_COMMIT_GRANULARITY - 1) & ~(u64)(OCAD_COMMIT_GRANULARITY - 1));
+}
+
+/** Allocates a zeroed buffer of at least the given size for a file, preferring a virtual
+ *  buffer. Returns OCAD_OK or OCAD_OUT_OF_MEMORY.
+ */
+static int ocad_file_alloc_buffer(OCADFile *pfile, u32 size) {
+	u8 *buffer = NULL;
+	u32 range = ocad_buffer_range(size);
+	if (size <= range - OCAD_COMMIT_GRANULARITY) {
+		buffer = ocad_buffer_reserve(range);
+	}
+	if (buffer != NULL) {
+		size = (size + OCAD_COMMIT_GRANULARITY - 1) & ~(OCAD_COMMIT_GRANULARITY - 1);
+		if (!ocad_buffer_commit(buffer, 0, size)) {
+			ocad_buffer_release(buffer, range);
+			return OCAD_OUT_OF_MEMORY;
+		}
+		pfile->storage = OCAD_STORAGE_VIRTUAL;
+		pfile->virtual_size = range;
+	}
+	else {
+		buffer = (u8 *)malloc(size);
+		if (buffer == NULL) return OCAD_OUT_OF_MEMORY;
+		memset(buffer, 0, size);
+		pfile->storage = OCAD_STORAGE_MALLOC;
+	}
+	pfile->buffer = buffer;
+	pfile->reserved_size = size;
+	return OCAD_OK;
 }
 
 
@@ -166,24 +455,18 @@ int ocad_file_open(OCADFile **pfile, const char *filename) {
 	file->fd = _open(file->filename, O_RDONLY | O_BINARY);
 	if (file->fd <= 0) { err = -2; goto ocad_file_open_1; }
 	if (fstat(file->fd, &fs) < 0) { err = -3; goto ocad_file_open_1; }
+	if (fs.st_size > 0xFFFFFFFFu) { err = OCAD_INVALID_FORMAT; goto ocad_file_open_1; }
 	file->size = fs.st_size;
-	file->reserved_size = file->size;
 
-#ifdef MMAP_AVAILABLE
-	file->buffer = mmap(NULL, file->size, PROT_READ | PROT_WRITE, 0, file->fd, 0);
-	if (file->buffer == NULL || file->buffer == MAP_FAILED) { err = -4; goto ocad_file_open_1; }
-#else
-	file->mapped = FALSE;
-	file->buffer = (u8*)malloc(file->size);
-	if (file->buffer == NULL) { err = -1; goto ocad_file_open_1; }
+	// A virtual buffer lets files opened for update grow without being copied
+	if (ocad_file_alloc_buffer(file, file->size) != OCAD_OK) { err = -1; goto ocad_file_open_1; }
 	left = file->size;
 	p = file->buffer;
 	while (left > 0) {
 		int got = _read(file->fd, p, left);
-		if (got <= 0) { fprintf(stderr,"got=%d sz=%d\n",got,file->size);err = -4; goto ocad_file_open_1; }
+		if (got <= 0) { err = -4; goto ocad_file_open_1; }
 		p += got; left -= got;
 	}
-#endif
 
 	file->header = (OCADFileHeader *)file->buffer;
 	file->colors = (OCADColor *)(file->buffer + 0x48);
@@ -199,8 +482,116 @@ ocad_file_open_0:
 	return err;
 }
 
+int ocad_file_open_update(OCADFile **pfile, const char *filename) {
+	OCADFile *file, *given = *pfile;
+	int err = ocad_file_open(pfile, filename);
+	if (err != 0) return err;
+	file = *pfile;
+	_close(file->fd);
+	file->fd = _open(file->filename, O_RDWR | O_BINARY);
+	if (file->fd <= 0) {
+		file->fd = 0;
+		ocad_file_close(file);
+		if (given == NULL) {
+			free(file);
+			*pfile = NULL;
+		}
+		return OCAD_FILE_WAS_READONLY;
+	}
+	file->update = TRUE;
+	file->update_size = file->size;
+	return 0;
+}
+
+void ocad_file_touch(OCADFile *pfile, const void *ptr, u32 size) {
+	dword start, end, *last;
+	if (!pfile->update || size == 0) return;
+	start = ocad_file_offset(pfile, ptr);
+	if (start >= pfile->update_size) return;
+	end = (size > pfile->update_size - start) ? pfile->update_size : start + size;
+	// Neighbouring entries are mostly changed one after another, so they are merged right away
+	if (pfile->update_nranges > 0) {
+		last = pfile->update_ranges + 2 * (pfile->update_nranges - 1);
+		if (start <= last[1] && end >= last[0]) {
+			if (start < last[0]) last[0] = start;
+			if (end > last[1]) last[1] = end;
+			return;
+		}
+	}
+	if (pfile->update_nranges == pfile->update_capacity) {
+		u32 capacity = pfile->update_capacity ? pfile->update_capacity * 2 : 256;
+		dword *ranges = (dword *)realloc(pfile->update_ranges, 2 * capacity * sizeof(dword));
+		if (ranges == NULL) {
+			// without memory for the range, the whole file is written
+			pfile->update_size = 0;
+			pfile->update_nranges = 0;
+			return;
+		}
+		pfile->update_ranges = ranges;
+		pfile->update_capacity = capacity;
+	}
+	pfile->update_ranges[2 * pfile->update_nranges] = start;
+	pfile->update_ranges[2 * pfile->update_nranges + 1] = end;
+	pfile->update_nranges++;
+}
+
 int ocad_file_open_mapped(OCADFile **pfile, const char *filename) {
-	return -10;
+	return ocad_file_open_mapped_flags(pfile, filename, 0);
+}
+
+int ocad_file_open_mapped_flags(OCADFile **pfile, const char *filename, int flags) {
+#ifdef OCAD_MMAP_FILES
+	struct stat fs;
+	void *view;
+	int err = 0;
+	dword offs;
+	OCADFile *file = *pfile;
+	if (file == NULL) {
+		file = (OCADFile *)malloc(sizeof(OCADFile));
+		if (file == NULL) return OCAD_OUT_OF_MEMORY;
+	}
+	memset(file, 0, sizeof(OCADFile));
+	file->filename = (const char *)my_strdup(filename);
+	file->fd = _open(file->filename, O_RDONLY | O_BINARY);
+	if (file->fd <= 0) { err = -2; goto ocad_file_open_mapped_1; }
+	if (fstat(file->fd, &fs) < 0) { err = OCAD_MMAP_FAILED; goto ocad_file_open_mapped_1; }
+	if (fs.st_size < (off_t)sizeof(OCADFileHeader) || fs.st_size > 0xFFFFFFFFu) { err = OCAD_INVALID_FORMAT; goto ocad_file_open_mapped_1; }
+
+	if (flags & OCAD_MAP_COPY_ON_WRITE) view = mmap(NULL, fs.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+	else view = mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+	if (view == MAP_FAILED) { err = OCAD_MMAP_FAILED; goto ocad_file_open_mapped_1; }
+	// The mapping keeps the file contents available, the descriptor is no longer needed
+	_close(file->fd);
+	file->fd = 0;
+
+	file->storage = OCAD_STORAGE_MAPPED;
+	file->buffer = (u8 *)view;
+	file->size = (u32)fs.st_size;
+	file->reserved_size = file->size;
+	file->virtual_size = file->size;
+
+	// Index scans jump between blocks all over the file, so read-ahead is mostly wasted unless
+	// the caller is going to read everything. The start of the file is needed right away.
+#if defined(MADV_RANDOM) && defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+	madvise(view, file->size, (flags & OCAD_MAP_SEQUENTIAL) ? MADV_SEQUENTIAL : MADV_RANDOM);
+	madvise(view, file->size < OCAD_COMMIT_GRANULARITY ? file->size : OCAD_COMMIT_GRANULARITY, MADV_WILLNEED);
+#endif
+
+	file->header = (OCADFileHeader *)file->buffer;
+	file->colors = (OCADColor *)(file->buffer + 0x48);
+	offs = file->header->osetup;
+	if (offs > 0 && offs < file->size) file->setup = (OCADSetup *)(file->buffer + offs);
+
+	*pfile = file;
+	return OCAD_OK;
+
+ocad_file_open_mapped_1:
+	ocad_file_close(file);
+	if (*pfile == NULL) free(file);
+	return err;
+#else
+	return OCAD_MMAP_NOT_SUPPORTED;
+#endif
 }
 
 int ocad_file_open_memory(OCADFile **pfile, u8* buffer, u32 size) {
@@ -213,7 +604,6 @@ int ocad_file_open_memory(OCADFile **pfile, u8* buffer, u32 size) {
 	}
 	memset(file, 0, sizeof(OCADFile));
 	
-	file->mapped = FALSE;
 	file->size = size;
 	file->buffer = buffer;
 	if (file->buffer == NULL) { return -1; }
@@ -228,21 +618,96 @@ int ocad_file_open_memory(OCADFile **pfile, u8* buffer, u32 size) {
 }
 
 int ocad_file_close(OCADFile *pfile) {
-#ifdef MMAP_AVAILABLE
-	if (pfile->buffer) munmap(pfile->buffer, pfile->size);
-#else
-	if (pfile->buffer) free(pfile->buffer);
-#endif
+	int i;
+	ocad_file_free_buffer(pfile);
 	if (pfile->fd) _close(pfile->fd);
 	if (pfile->filename) free((void *)pfile->filename);
+	if (pfile->symtab) free(pfile->symtab);
+	ocad_spatial_invalidate(pfile);
+	for (i = 0; i < OCAD_FREE_CLASSES; i++) free(pfile->free_slots[i].entries);
+	free(pfile->free_entries.entries);
+	memset(pfile->free_slots, 0, sizeof(pfile->free_slots));
+	memset(&pfile->free_entries, 0, sizeof(OCADFreeList));
+	free(pfile->objidx_blocks);
+	pfile->objidx_blocks = NULL;
+	pfile->objidx_nblocks = pfile->objidx_blocks_capacity = 0;
+	free(pfile->update_ranges);
+	pfile->update_ranges = NULL;
+	pfile->update_nranges = pfile->update_capacity = 0;
+	return 0;
+}
+
+/** Writes size bytes from data to the given position in the file opened by fd. Returns 0 on
+ *  success, or -3 if the data could not be written completely.
+ */
+static int ocad_file_write_at(int fd, dword pos, const u8 *data, u32 size) {
+#ifdef _MSC_VER
+	if (_lseek(fd, (long)pos, SEEK_SET) < 0) return -3;
+#else
+	if (lseek(fd, (off_t)pos, SEEK_SET) < 0) return -3;
+#endif
+	while (size > 0) {
+		int got = _write(fd, data, size);
+		if (got <= 0) return -3;
+		data += got; size -= got;
+	}
+	return 0;
+}
+
+static int ocad_file_range_cmp(const void *a, const void *b) {
+	dword x = *(const dword *)a, y = *(const dword *)b;
+	return (x > y) - (x < y);
+}
+
+/** Writes the changes of a file opened with ocad_file_open_update() back to it: the data behind
+ *  the old end first, then the changed ranges which refer to it, and the header last.
+ */
+static int ocad_file_save_update(OCADFile *pfile) {
+	dword *r = pfile->update_ranges;
+	struct stat fs;
+	u32 i, n = 0;
+	int err = 0;
+	if (pfile->size > pfile->update_size) {
+		err = ocad_file_write_at(pfile->fd, pfile->update_size, pfile->buffer + pfile->update_size, pfile->size - pfile->update_size);
+	}
+	if (pfile->update_nranges > 0) {
+		// Overlapping and adjacent ranges are merged, so each part is written once
+		qsort(r, pfile->update_nranges, 2 * sizeof(dword), ocad_file_range_cmp);
+		for (i = 0; i < pfile->update_nranges; i++) {
+			if (n > 0 && r[2 * i] <= r[2 * n - 1]) {
+				if (r[2 * i + 1] > r[2 * n - 1]) r[2 * n - 1] = r[2 * i + 1];
+			}
+			else {
+				r[2 * n] = r[2 * i];
+				r[2 * n + 1] = r[2 * i + 1];
+				n++;
+			}
+		}
+	}
+	for (i = 0; i < n && err == 0; i++) {
+		err = ocad_file_write_at(pfile->fd, r[2 * i], pfile->buffer + r[2 * i], r[2 * i + 1] - r[2 * i]);
+	}
+	if (err == 0) err = ocad_file_write_at(pfile->fd, 0, pfile->buffer, sizeof(OCADFileHeader));
+	// A compacted file may have become shorter
+	if (err == 0 && fstat(pfile->fd, &fs) == 0 && (u32)fs.st_size > pfile->size) {
+#ifdef _MSC_VER
+		if (_chsize(pfile->fd, (long)pfile->size) != 0) err = -3;
+#else
+		if (ftruncate(pfile->fd, (off_t)pfile->size) != 0) err = -3;
+#endif
+	}
+	if (err != 0) return err;
+	pfile->update_size = pfile->size;
+	pfile->update_nranges = 0;
 	return 0;
 }
 
 int ocad_file_save(OCADFile *pfile) {
-	if (pfile->mapped) {
+	if (pfile->storage == OCAD_STORAGE_MAPPED) {
 		// FIXME: sync the memory map
 		return -10;
 	}
+	if (pfile->update) return ocad_file_save_update(pfile);
 	return ocad_file_save_as(pfile, pfile->filename);
 }
 
@@ -251,7 +716,9 @@ int ocad_file_save_as(OCADFile *pfile, const char *filename) {
 	// It saves to another file, without modifying the filename
 	int err = 0;
 	int got;
-	int fd = _open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0664);
+	int fd;
+	if (pfile->head_size != 0) return -1; // streaming files are incomplete in memory
+	fd = _open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0664);
 	if (fd < 0) { err = -2; goto ocad_file_save_as_0; }
 	got = _write(fd, pfile->buffer, pfile->size);
 	if (got != pfile->size) { err = -3; goto ocad_file_save_as_1; }
@@ -263,6 +730,10 @@ ocad_file_save_as_0:
 }
 
 int ocad_file_new(OCADFile **pfile) {
+	return ocad_file_new_reserved(pfile, 0);
+}
+
+int ocad_file_new_reserved(OCADFile **pfile, u32 amount) {
 	OCADFile *pnew;
 	u8 *dest, *p;
 	u32 size;
@@ -270,20 +741,19 @@ int ocad_file_new(OCADFile **pfile) {
 	// Create OCADFile struct
 	pnew = (OCADFile *)malloc(sizeof(OCADFile));
 	if (pnew == NULL) return -1;
+	memset(pnew, 0, sizeof(OCADFile));
 	pnew->filename = NULL;
 	pnew->fd = 0;
-	pnew->mapped = FALSE;
 	
 	// Allocate buffer
-	size = 1024 * 1024;	// start with 1 MiB
-	dest = (u8 *)malloc(size);
-	if (dest == NULL) return -1;
-	memset(dest, 0, size);
+	size = sizeof(OCADFileHeader) + 256 * sizeof(OCADColor) + 32 * sizeof(OCADColorSeparation)
+		+ sizeof(OCADSetup) + sizeof(OCADSymbolIndex) + sizeof(OCADObjectIndex) + sizeof(OCADStringIndex);
+	size = (amount > 0xFFFFFFFFu - size) ? 0xFFFFFFFFu : size + amount;
+	if (size < 1024 * 1024) size = 1024 * 1024;	// start with at least 1 MiB
+	if (ocad_file_alloc_buffer(pnew, size) != OCAD_OK) { free(pnew); return -1; }
+	dest = pnew->buffer;
 	p = dest;
 	
-	pnew->buffer = dest;
-	pnew->reserved_size = size;
-	
 	// Place header at start
 	pnew->header = (OCADFileHeader *)dest;
 	p += sizeof(OCADFileHeader);
@@ -317,94 +787,220 @@ int ocad_file_new(OCADFile **pfile) {
 	return 0;
 }
 
-int ocad_file_reserve(OCADFile *file, int amount) {
-	u32 old_reserved_size = file->reserved_size;
-	if (file->reserved_size - file->size >= amount)
+u8 *ocad_file_ptr(OCADFile *pfile, dword offs) {
+	// Streaming files keep [0, head_size) and [flushed, size) in memory, back to back
+	if (offs >= pfile->flushed) return pfile->buffer + (offs - (pfile->flushed - pfile->head_size));
+	if (offs < pfile->head_size) return pfile->buffer + offs;
+	return NULL;
+}
+
+dword ocad_file_offset(OCADFile *pfile, const void *ptr) {
+	dword pos = (const u8 *)ptr - pfile->buffer;
+	if (pos < pfile->head_size) return pos;
+	return pos + (pfile->flushed - pfile->head_size);
+}
+
+int ocad_file_stream(OCADFile *pfile, const char *filename) {
+	int fd;
+	if (pfile->head_size != 0 || pfile->storage == OCAD_STORAGE_MAPPED || pfile->update) return -1;
+	fd = _open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0664);
+	if (fd < 0) return -2;
+	if (pfile->fd) _close(pfile->fd);
+	pfile->fd = fd;
+	pfile->head_size = pfile->size;
+	pfile->flushed = pfile->size;
+	return 0;
+}
+
+int ocad_file_stream_flush(OCADFile *pfile, dword offs) {
+	u8 *start = pfile->buffer + pfile->head_size;
+	u32 size = offs - pfile->flushed;
+	int err;
+	if (pfile->head_size == 0 || offs <= pfile->flushed) return 0;
+	err = ocad_file_write_at(pfile->fd, pfile->flushed, start, size);
+	if (err) return err;
+	// Move the data which is still in progress to the start of the window
+	memmove(start, start + size, pfile->size - offs);
+	memset(start + (pfile->size - offs), 0, size);
+	pfile->flushed = offs;
+	return 0;
+}
+
+int ocad_file_stream_end(OCADFile *pfile) {
+	int err;
+	if (pfile->head_size == 0 || pfile->fd == 0) return -1;
+	err = ocad_file_write_at(pfile->fd, pfile->flushed, pfile->buffer + pfile->head_size, pfile->size - pfile->flushed);
+	if (err == 0) err = ocad_file_write_at(pfile->fd, 0, pfile->buffer, pfile->head_size);
+	_close(pfile->fd);
+	pfile->fd = 0;
+	return err;
+}
+
+int ocad_file_reserve(OCADFile *file, u32 amount) {
+	u32 used = file->size - (file->flushed - file->head_size); // bytes in memory
+	u64 needed, size;
+	u8 *buffer;
+	u32 header_offset, colors_offset, setup_offset;
+	if (amount == 0 || file->reserved_size - used >= amount)
 		return 0;
+	if (file->storage == OCAD_STORAGE_MAPPED) return OCAD_OUT_OF_MEMORY; // a mapped file can't grow
+	
+	needed = (u64)used + amount;
+	size = file->reserved_size ? file->reserved_size : OCAD_COMMIT_GRANULARITY;
+	while (size < needed) {
+		size *= 2;
+	}
 	
-	u32 header_offset = (u8*)file->header - file->buffer;
-	u32 colors_offset = (u8*)file->colors - file->buffer;
-	u32 setup_offset = (u8*)file->setup - file->buffer;
+	if (file->storage == OCAD_STORAGE_VIRTUAL) {
+		size = (size + OCAD_COMMIT_GRANULARITY - 1) & ~(u64)(OCAD_COMMIT_GRANULARITY - 1);
+		if (size > file->virtual_size) size = file->virtual_size;
+		if (size >= needed) {
+			// The buffer grows in place; committed pages are zero already
+			if (!ocad_buffer_commit(file->buffer, file->reserved_size, (u32)size)) return OCAD_OUT_OF_MEMORY;
+			file->reserved_size = (u32)size;
+			return 0;
+		}
+		size = needed; // the reserved range is exhausted, continue on the heap
+	}
+	if (size > 0xFFFFFFFFu) size = needed;
+	if (size > 0xFFFFFFFFu) return OCAD_OUT_OF_MEMORY;
+	
+	header_offset = (u8*)file->header - file->buffer;
+	colors_offset = (u8*)file->colors - file->buffer;
+	setup_offset = (u8*)file->setup - file->buffer;
 	
-	while (file->reserved_size - file->size < amount) {
-		file->reserved_size *= 2;
+	if (file->storage == OCAD_STORAGE_VIRTUAL) {
+		buffer = (u8*)malloc((size_t)size);
+		if (buffer == NULL) return OCAD_OUT_OF_MEMORY;
+		memcpy(buffer, file->buffer, file->reserved_size);
+		ocad_file_free_buffer(file);
+		file->storage = OCAD_STORAGE_MALLOC;
+	}
+	else {
+		buffer = (u8*)realloc(file->buffer, (size_t)size);
+		if (buffer == NULL) return OCAD_OUT_OF_MEMORY;
 	}
-	file->buffer = (u8*)realloc(file->buffer, file->reserved_size);
+	memset(buffer + file->reserved_size, 0, (size_t)size - file->reserved_size);
+	file->buffer = buffer;
+	file->reserved_size = (u32)size;
 	
 	file->header = (OCADFileHeader*)(file->buffer + header_offset);
 	file->colors = (OCADColor*)(file->buffer + colors_offset);
 	file->setup = (OCADSetup*)(file->buffer + setup_offset);
-	
-	if (file->buffer == NULL) return -1;
-	memset(file->buffer + old_reserved_size, 0, file->reserved_size - old_reserved_size);
 	return 0;
 }
 
 int ocad_file_compact(OCADFile *pfile) {
-	OCADFile dfile, *pnew;
-	u8 *dest, *p;
-	u32 size;
-	IndexBuilder b;
+	return ocad_file_compact_ex(pfile, OCAD_COMPACT_REFRESH_RECTS, 1);
+}
+
+int ocad_file_compact_ex(OCADFile *pfile, int flags, u32 threads) {
+	OCADCompactSection sections[3];
+	OCADCompactJob job;
+	OCADFile dfile;
+	dword osetup, ssetup, nsetup, p, written, read;
+	u32 nworkers, n;
+	bool in_place;
+	int i, ret = OCAD_OUT_OF_MEMORY;
 	if (!pfile || !pfile->header) return -1; // invalid file
+	if (pfile->head_size != 0) return -1; // streaming files are not completely in memory
 
-	// compact should always make the file smaller, so the current size should be enough?
-	pnew = &dfile;
-	dest = (u8 *)malloc(pfile->size);
-	p = dest;
-	pnew->buffer = dest;
-	pnew->size = pfile->size; // will change this later...
-	pnew->reserved_size = pfile->size;
-	pnew->header = (OCADFileHeader *)dest;
+	// Gather the live entries of the symbols, objects and strings
+	memset(sections, 0, sizeof(sections));
+	sections[0].entry_size = sizeof(OCADSymbolEntry);
+	sections[0].ptr_offset = offsetof(OCADSymbolEntry, ptr);
+	sections[1].entry_size = sizeof(OCADObjectEntry);
+	sections[1].ptr_offset = offsetof(OCADObjectEntry, ptr);
+	sections[2].entry_size = sizeof(OCADStringEntry);
+	sections[2].ptr_offset = offsetof(OCADStringEntry, ptr);
+	if (!ocad_symbol_iterate(pfile, ocad_compact_symbol_cb, &sections[0])
+			|| !ocad_object_entry_iterate(pfile, ocad_compact_object_cb, &sections[1])
+			|| !ocad_string_entry_iterate(pfile, ocad_compact_string_cb, &sections[2])) {
+		goto ocad_file_compact_ex_1;
+	}
 
-	b.base = dest;
-	fprintf(stderr, "Compacting: base=%p\n", dest);
+	// New layout: the header and the complete color table keep their place, the setup follows
+	// them, and then each section
+	osetup = pfile->header->osetup;
+	ssetup = pfile->header->ssetup;
+	nsetup = sizeof(OCADFileHeader) + 256 * sizeof(OCADColor) + 32 * sizeof(OCADColorSeparation);
+	p = nsetup + ssetup;
+	for (i = 0; i < 3; i++) {
+		p = ocad_compact_layout(&sections[i], p);
+		if (p == 0) goto ocad_file_compact_ex_1;
+	}
 
-	// Copy the file header
-	p = copy_and_advance(p, pfile->header, sizeof(OCADFileHeader));
-	fprintf(stderr, "Compacting: copied file header, p=%p\n", p);
+	// Compact in place if no data would be overwritten before it has been moved. Mapped files
+	// are always copied, so the file on disk doesn't change.
+	in_place = (pfile->storage == OCAD_STORAGE_MALLOC || pfile->storage == OCAD_STORAGE_VIRTUAL)
+		&& p <= pfile->reserved_size && (ssetup == 0 || nsetup <= osetup);
+	written = nsetup + ssetup;
+	read = ssetup ? osetup + ssetup : 0;
+	for (i = 0; i < 3 && in_place; i++) in_place = ocad_compact_check(&sections[i], &written, &read);
 
-	// Copy the color table
-	pnew->colors = (OCADColor *)p;
-	size = pfile->header->ncolors * sizeof(OCADColor);
-	p = copy_and_advance(p, pfile->colors, size);
-	fprintf(stderr, "Compacting: copied color table, p=%p\n", p);
+	memset(&job, 0, sizeof(job));
+	job.src = pfile->buffer;
+	job.end = p;
+	if (in_place) job.dest = pfile->buffer;
+	else {
+		memset(&dfile, 0, sizeof(dfile));
+		if (ocad_file_alloc_buffer(&dfile, p) != OCAD_OK) goto ocad_file_compact_ex_1;
+		job.dest = dfile.buffer;
+		memcpy(job.dest, job.src, (ssetup && osetup < nsetup) ? osetup : nsetup);
+	}
+	if (ssetup) memmove(job.dest + nsetup, job.src + osetup, ssetup);
+	memset(job.dest + nsetup + ssetup, 0, ocad_compact_align(nsetup + ssetup) - (nsetup + ssetup));
 
-	// Copy the setup data
-	size = pfile->header->ssetup;
-	pnew->header->osetup = (p - dest);
-	pnew->header->ssetup = size;
-	pnew->setup = (OCADSetup *)p;
-	p = copy_and_advance(p, pfile->setup, size);
-	fprintf(stderr, "Compacting: copied setup block, p=%p\n", p);
-
-	// Copy the symbols
-	b.p = p; b.pfirst = &(pnew->header->osymidx); b.idx = NULL; b.i = 255;
-	ocad_symbol_iterate(pfile, ocad_file_compact_symbol_cb, &b);
-	fprintf(stderr, "Compacting: copied symbols, p=%p\n", b.p);
-	//dump_bytes(dest, b.p - dest);
-
-	// Copy the objects
-	b.pfirst = &(pnew->header->oobjidx); b.idx = NULL; b.i = 255;
-	ocad_object_entry_iterate(pfile, ocad_file_compact_object_entry_cb, &b);
-	fprintf(stderr, "Compacting: copied objects, p=%p\n", b.p);
-
-	// Copy the strings
-	b.pfirst = &(pnew->header->ostringidx); b.idx = NULL; b.i = 255;
-	ocad_string_entry_iterate(pfile, ocad_file_compact_string_entry_cb, &b);
-	fprintf(stderr, "Compacting: copied template, p=%p\n", b.p);
-
-	// We're done!
-	p = b.p;
-	pnew->size = (p - dest);
-	fprintf(stderr, "Compaction changed size from %x to %x\n", pfile->size, pnew->size);
-	free(pfile->buffer);
-	pfile->buffer = pnew->buffer;
-	pfile->size = pnew->size;
-	pfile->header = pnew->header;
-	pfile->colors = pnew->colors;
-	pfile->setup = pnew->setup;
+	// Move the sections. Moves in place have to go in order; copies of the objects, which make up
+	// most of the file, are spread over the threads.
+	nworkers = threads ? threads : ocad_processor_count();
+	for (i = 0; i < 3; i++) {
+		job.section = &sections[i];
+		n = (i == 1 && !in_place) ? nworkers : 1;
+		if (n > sections[i].nblocks) n = sections[i].nblocks;
+		ocad_run_workers(n, ocad_compact_move_worker, &job);
+	}
 
-	return 0;
+	// Switch over to the new layout
+	if (in_place) {
+		if (pfile->size > p) memset(pfile->buffer + p, 0, pfile->size - p);
+	}
+	else {
+		ocad_file_free_buffer(pfile);
+		pfile->storage = dfile.storage;
+		pfile->buffer = dfile.buffer;
+		pfile->reserved_size = dfile.reserved_size;
+		pfile->virtual_size = dfile.virtual_size;
+	}
+	pfile->size = p;
+	pfile->header = (OCADFileHeader *)pfile->buffer;
+	pfile->header->osetup = ssetup ? nsetup : 0;
+	pfile->header->osymidx = sections[0].blocks[0];
+	pfile->header->oobjidx = sections[1].blocks[0];
+	pfile->header->ostringidx = sections[2].blocks[0];
+	pfile->colors = (OCADColor *)(pfile->buffer + sizeof(OCADFileHeader));
+	pfile->setup = (OCADSetup *)(pfile->buffer + nsetup);
+	pfile->objidx_tail = 0; // the object index tail is located again on the next append
+	pfile->update_size = 0; // everything has moved, an update writes the whole file
+	pfile->update_nranges = 0;
+	if (pfile->symtab) free(pfile->symtab);
+	pfile->symtab = NULL; // symbol offsets have changed, the table is built again on the next lookup
+	pfile->symtab_pending = 0;
+	ocad_spatial_invalidate(pfile);
+
+	// Fix up the object entries. The symbol table is built first, since the workers look up symbols.
+	job.pfile = pfile;
+	job.src = job.dest = pfile->buffer;
+	job.section = &sections[1];
+	job.refresh = (flags & OCAD_COMPACT_REFRESH_RECTS) != 0;
+	ocad_symbol(pfile, 0);
+	n = sections[1].count / 4096 + 1;
+	ocad_run_workers(n < nworkers ? n : nworkers, ocad_compact_refresh_worker, &job);
+	ret = 0;
+
+ocad_file_compact_ex_1:
+	for (i = 0; i < 3; i++) ocad_compact_free(&sections[i]);
+	return ret;
 }
 
 int ocad_export(OCADFile *pfile, void *opts) {
@@ -449,6 +1045,8 @@ static bool ocad_file_bounds_cb(void *param, OCADFile *file, OCADObjectEntry *en
 
 bool ocad_file_bounds(OCADFile *file, OCADRect *rect) {
 	ocad_file_bounds_data data;
+	// A spatial index knows the bounds already
+	if (file->spatial != NULL) return ocad_spatial_bounds(file, rect);
 	data.empty = TRUE;
 	ocad_object_entry_iterate(file, ocad_file_bounds_cb, &data);
 	if (!data.empty) {
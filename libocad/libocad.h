@@ -487,6 +487,30 @@ struct _OCADSetup {
 , OCADSetup)
 
 
+/** Spatial index over the object index entries, see ocad_spatial_build(). */
+typedef struct _OCADSpatialIndex OCADSpatialIndex;
+
+/** Number of size classes of removed objects. Objects with room for less than 4 points have a
+ *  class for each size; above, each power of two is split into four classes of equal width.
+ */
+#define OCAD_FREE_CLASSES 60
+
+/** A stack of object index entries, given by their offsets in the file. */
+typedef
+struct _OCADFreeList {
+	dword *entries;
+	u32 count;
+	u32 capacity;
+}
+OCADFreeList;
+
+/** The buffer is a heap block which grows with realloc(). */
+#define OCAD_STORAGE_MALLOC 0
+/** The buffer is a reserved range of address space which grows in place by committing more pages. */
+#define OCAD_STORAGE_VIRTUAL 1
+/** The buffer is a memory mapped view of the file, which can't grow. */
+#define OCAD_STORAGE_MAPPED 2
+
 typedef
 struct _OCADFile {
 	const char *filename;	// Filename
@@ -494,11 +518,35 @@ struct _OCADFile {
 	u8 *buffer;				// Location of the buffer
 	u32 size;				// Size of the used part of the buffer
 	u32 reserved_size;		// Complete size of the buffer
-	bool mapped;			// Flag indicating whether the memory is mapped
+	u8 storage;				// How the buffer was allocated, one of the OCAD_STORAGE_* values
+	u32 virtual_size;		// Size of the address range reserved for a virtual buffer or mapped from a file
 
 	OCADFileHeader *header; // Pointer to file header
 	OCADColor *colors;		// Pointer to first element of color array.
 	OCADSetup *setup;		// Pointer to setup object
+
+	dword objidx_tail;		// Offset of the last object index block, 0 until it has been located
+	u32 objidx_tail_count;	// Number of entries in use at the start of the last object index block
+	dword *objidx_blocks;	// Offsets of the object index blocks in index order, see ocad_object_handle()
+	u32 objidx_nblocks;		// Number of offsets in objidx_blocks
+	u32 objidx_blocks_capacity;	// Number of offsets which fit into objidx_blocks
+	OCADFreeList free_slots[OCAD_FREE_CLASSES];	// Removed objects in front of the tail, by size class
+	OCADFreeList free_entries;	// Unused entries in front of the tail, which have no space of their own
+	u64 free_bytes;			// Size of the space held by the removed objects in free_slots
+	u8 compact_threshold;	// Percentage of removed object space which triggers compaction, 0 for never
+
+	u32 head_size;			// Streaming: size of the start of the file which is kept in memory
+	u32 flushed;			// Streaming: offset up to which the file has been written to disk
+
+	bool update;			// Opened with ocad_file_open_update(), saving writes back only the changes
+	u32 update_size;		// Update: size of the file on disk, everything behind it is new
+	dword *update_ranges;	// Update: start and end offsets of the changed ranges in front of update_size
+	u32 update_nranges;		// Update: number of ranges in update_ranges
+	u32 update_capacity;	// Update: number of ranges which fit into update_ranges
+
+	dword *symtab;			// Symbol offsets by symbol number, NULL until the first lookup
+	dword symtab_pending;	// Offset of the symbol added last, entered into symtab on the next lookup
+	OCADSpatialIndex *spatial;	// Spatial index of the object entries, NULL until the first spatial query
 }
 OCADFile;
 
@@ -533,20 +581,20 @@ struct _OCADExportOptions {
 };
 
 // PRIVATE to OCADPaintData
-typedef
-struct _OCADPaintSymbolIndex {
-	u16 count;
-	u16 size;
-	u16 *num;
-	PtrArray *arr;
-    u8 *data;
-}
-OCADPaintSymbolIndex;
-
+// Objects are bucketed by symbol, and each color lists the buckets of the symbols using it. All
+// lists are stored in contiguous arrays with start offsets, so a fill only counts and places.
 typedef
 struct _OCADPaintColorIndex {
-	u16 nsyms;
-	OCADPaintSymbolIndex *idx[256];
+	u32 nsyms;				// Number of symbol buckets
+	s16 *symbols;			// Symbol number of each bucket
+	u16 *bucket;			// Bucket + 1 of each symbol number, 0 for unknown symbols
+	u32 color_start[257];	// Buckets of color index c: color_buckets[color_start[c] .. color_start[c + 1] - 1]
+	u32 *color_buckets;
+	u32 *object_start;		// Objects of bucket b: objects[object_start[b] .. object_start[b + 1] - 1]
+	dword *objects;			// Object offsets
+	u32 nobjects;			// Number of objects filled in
+	u32 capacity;			// Room in objects and scratch
+	u16 *scratch;			// Bucket of each object while filling
 }
 OCADPaintColorIndex;
 // PRIVATE to OCADPaintData
@@ -592,7 +640,10 @@ typedef bool (*IntPathCallback)(void *, SegmentType, s32 *);
 #define OCAD_MMAP_NOT_SUPPORTED -10
 
 
-/** Iterates over an set of OCAD points, providing a list of PostScript-like path segments.
+/** Iterates over an set of OCAD points, providing a list of PostScript-like path segments. Each
+ *  hole starts with a MoveTo, and runs against the outline. The points are read in place, without
+ *  any allocation. Returns FALSE if the callback returned FALSE, which ends the iteration, or if
+ *  the points don't make a valid path.
  */
 bool ocad_path_iterate(u32 npts, const OCADPoint *pts, IntPathCallback callback, void *param);
 
@@ -678,6 +729,56 @@ bool ocad_rect_grow(OCADRect *prect, s32 amount);
 bool ocad_rect_intersects(const OCADRect *r1, const OCADRect *r2);
 
 
+/** Transforms npts points given as separate arrays of x and y coordinates by the matrix, and
+ *  stores them as OCADPoints without flags. Coordinates are rounded to the nearest map unit,
+ *  halves away from zero. The arrays must not overlap.
+ *
+ *  Returns TRUE on success, or FALSE if a transformed coordinate is not a number or doesn't fit
+ *  into the 24 bits of an OCADPoint coordinate; the contents of opts are undefined then.
+ *
+ *  The conversion uses AVX or SSE2 where the compiler and processor support them, and gives the
+ *  same results as the portable code.
+ */
+bool ocad_path_from_world(const Transform *matrix, const double *x, const double *y, OCADPoint *opts, u32 npts);
+
+
+/** Simplifies a path in place and returns the new number of points. Points which repeat the
+ *  position of the previous point are dropped. If tolerance is above zero, the Douglas-Peucker
+ *  algorithm also drops points which are at most tolerance map units away from the simplified
+ *  path.
+ *
+ *  The end points, points with flags (corners, holes, dashes, control points) and the ends of
+ *  curves are never dropped, so rings and curves keep their structure.
+ */
+u32 ocad_path_simplify(OCADPoint *pts, u32 npts, s32 tolerance);
+
+
+/** Clips an area against the half plane where the x (axis 0) or y (axis 1) coordinate is at
+ *  most value, if below is TRUE, or at least value otherwise. Each ring of the area (the outline,
+ *  followed by holes starting at points flagged with PY_HOLE) is clipped on its own; rings with
+ *  less than three points left are dropped, and so is the whole area if the outline is.
+ *
+ *  The clipped area is stored in opts, which needs room for 2 * npts points, and the number of
+ *  points is returned. Other flags than PY_HOLE are not kept, so curves are clipped as if their
+ *  control points were corners. Clipping an area with both values of below at the same value
+ *  gives two areas which cover the original one without overlap.
+ */
+u32 ocad_path_clip(const OCADPoint *pts, u32 npts, int axis, s32 value, bool below, OCADPoint *opts);
+
+
+/** Replaces runs of plain points in a path by cubic Bezier curves (points flagged with PX_CTL1 and
+ *  PX_CTL2) which stay within tolerance map units of every point they replace, and stores the
+ *  result in opts, which needs room for npts points and must not overlap pts. Returns the number
+ *  of points written, which is never more than npts; runs that are straight within tolerance
+ *  become a single segment.
+ *
+ *  The end points, points with flags, the last point of each ring and the ends of curves already
+ *  in the path stay where they are, so corners, holes and dashes are kept. Consecutive curves meet
+ *  smoothly. With tolerance 0 or less the path is copied unchanged.
+ */
+u32 ocad_path_fit_curves(const OCADPoint *pts, u32 npts, s32 tolerance, OCADPoint *opts);
+
+
 /** Converts an OCAD string of the correct type into an OCADBackground structure.
  */
 int ocad_to_background(OCADBackground *bg, OCADCString *templ);
@@ -688,13 +789,67 @@ int ocad_to_background(OCADBackground *bg, OCADCString *templ);
  */
 int ocad_file_new(OCADFile **pfile);
 
+/** Creates a new OCADFile struct in memory like ocad_file_new(), and makes sure that 'amount' bytes
+ *  can be added without growing the buffer again. ocad_object_storage_size() calculates the amount
+ *  needed for a known number of objects and points.
+ *
+ *  Where the system supports it, the buffer is a range of address space which is reserved for the
+ *  largest possible file and committed as needed, so the buffer never moves or gets copied. On 32 bit
+ *  systems the range is only reserved for twice the amount, to spare the address space; a file
+ *  growing beyond it continues on the heap. Files loaded by ocad_file_open() get such a buffer too.
+ *
+ *  Returns OCAD_OK on success, or OCAD_OUT_OF_MEMORY.
+ */
+int ocad_file_new_reserved(OCADFile **pfile, u32 amount);
+
 /** Makes sure that 'amount' number of bytes are reserved in the file's buffer
  *  in addition to the already used space. Sets newly reserved memory to zero.
- *  Returns OCAD_OK or OCAD_OUT_OF_MEMORY.
+ *  Returns OCAD_OK or OCAD_OUT_OF_MEMORY, also if the buffer would grow beyond 4 GB.
  * 
  *  WARNING: be extremely careful with this, as it might invalidate pointers to the buffer!
+ *  (Virtual buffers of new files grow in place until their reserved range is used up.)
+ */
+int ocad_file_reserve(OCADFile *file, u32 amount);
+
+/** Returns a pointer to the data at the given offset in the file. This is the same as
+ *  (pfile->buffer + offs), except for streaming files, where NULL is returned for data which
+ *  has already been written to disk.
  */
-int ocad_file_reserve(OCADFile *file, int amount);
+u8 *ocad_file_ptr(OCADFile *pfile, dword offs);
+
+/** Returns the file offset of a pointer into the file's buffer. This is the inverse of
+ *  ocad_file_ptr().
+ */
+dword ocad_file_offset(OCADFile *pfile, const void *ptr);
+
+/** Starts streaming a new file to the given filename. Everything which is in the file at the time of
+ *  this call (header, colors, setup, index blocks and symbols) stays in memory until the end. Data
+ *  which is appended afterwards is written to disk as soon as an object index block is full, so the
+ *  memory use does not grow with the number of objects. Symbols should be added before calling this
+ *  function, since symbols which have been written out can no longer be looked up.
+ *
+ *  While streaming, objects are always appended, and only the objects of the last index block can be
+ *  accessed, removed or iterated. The file must be completed with ocad_file_stream_end().
+ *
+ *  Returns 0 on success, -1 if the file is already streaming, or -2 if the file cannot be opened
+ *  for writing.
+ */
+int ocad_file_stream(OCADFile *pfile, const char *filename);
+
+/** Writes the data of a streaming file up to the given offset to disk and drops it from memory.
+ *  This is called by ocad_object_entry_new() whenever a new object index block is started, so
+ *  callers usually don't need it. Returns 0 on success, or -3 if the data could not be written
+ *  completely. Does nothing for files which aren't streaming.
+ */
+int ocad_file_stream_flush(OCADFile *pfile, dword offs);
+
+/** Writes the remaining data of a streaming file, followed by the start of the file which was kept in
+ *  memory, and closes the output. Afterwards the OCADFile can only be closed with ocad_file_close().
+ *
+ *  Returns 0 on success, -1 if the file isn't streaming, or -3 if the data could not be written
+ *  completely.
+ */
+int ocad_file_stream_end(OCADFile *pfile);
 
 /** Opens a file with the given filename. The file is loaded into memory and is accessible through
  *  the various ocad_file_* methods. The first argument can either be a pointer to a pre-allocated
@@ -717,7 +872,9 @@ int ocad_file_open(OCADFile **pfile, const char *filename);
 
 
 /** Behaves exactly like ocad_file_open(), except that the system attempts to open the file via memory
- *  mapping.
+ *  mapping. Opening takes constant time, and only the parts of the file which are accessed are read
+ *  from disk. The mapping is read-only, so the file can't be modified; use ocad_file_open_mapped_flags()
+ *  with OCAD_MAP_COPY_ON_WRITE to modify it in memory.
  *
  *  Returns 0 on success, one of the error codes returned by ocad_file_open(), or one of the following:<ul>
  *     <li>OCAD_MMAP_NOT_SUPPORTED: Memory mapping is not supported with this combination of system and libraries.
@@ -726,6 +883,41 @@ int ocad_file_open(OCADFile **pfile, const char *filename);
 int ocad_file_open_mapped(OCADFile **pfile, const char *filename);
 
 
+/** Pages of the mapping are private copies once written, so the file can be modified in memory
+ *  without changing the file on disk. The size of the file still can't change. */
+#define OCAD_MAP_COPY_ON_WRITE 1
+/** The file will be read from start to end, so pages are read ahead aggressively. By default the
+ *  access is assumed to be random, like when following the index blocks. */
+#define OCAD_MAP_SEQUENTIAL 2
+
+/** Behaves like ocad_file_open_mapped(), with a combination of the OCAD_MAP_* flags.
+ */
+int ocad_file_open_mapped_flags(OCADFile **pfile, const char *filename, int flags);
+
+
+/** Behaves like ocad_file_open(), and keeps the file open for writing back changes with
+ *  ocad_file_save(). Objects, index blocks and symbols which are added or moved go to the end of
+ *  the file, and the space of removed objects which were in the file on disk is not reused, so
+ *  nothing in front of the old end is overwritten except the index entries, links and headers
+ *  which change. Only these ranges and the new end of the file are written then.
+ *
+ *  The libocad functions record what they change; callers which modify the file buffer in front
+ *  of the old end directly, like the colors or the setup, call ocad_file_touch() for it. Once the
+ *  file is compacted, it is written back completely.
+ *
+ *  Returns the error codes of ocad_file_open(), or OCAD_FILE_WAS_READONLY if the file can't be
+ *  opened for writing.
+ */
+int ocad_file_open_update(OCADFile **pfile, const char *filename);
+
+
+/** Records that size bytes at ptr in the file buffer have changed, so that ocad_file_save() writes
+ *  them back to a file opened with ocad_file_open_update(). Does nothing for other files, and for
+ *  data behind the end of the file on disk, which is always written.
+ */
+void ocad_file_touch(OCADFile *pfile, const void *ptr, u32 size);
+
+
 /** Behaves exactly like ocad_file_open(), except that the given buffer must contain the map data.
  *  The buffer must be allocated with malloc(). Ownership of the buffer is transferred to libocad.
  */
@@ -743,18 +935,74 @@ int ocad_file_close(OCADFile *pfile);
 
 /** Optimizes and repairs an open OCADFile. The file is reordered into Header, Colors, Setup, Symbols,
  *  Objects, and Strings. Entities of the same type are brought together into a contiguous section
- *  of file and any free space is compacted. The entity indexes are likewise compacted and cached data
- *  in the entities and index entries is regenerated, as follows:
+ *  of file and any free space is compacted. The entity indexes are likewise compacted, and the
+ *  bounding rectangle of each object is recalculated from the path and symbol.
  *
- * <p> Symbols: The "extent" field is recalculated from the symbol properties.
- * <p> Objects: The bounding rectangle is recalculated from the path and symbol.
+ *  This is ocad_file_compact_ex() with OCAD_COMPACT_REFRESH_RECTS on a single thread.
  */
 int ocad_file_compact(OCADFile *pfile);
 
 
-/** Saves an open OCADFile to the given filename.
+/** Recalculate the bounding rectangles of all objects while compacting, not only invalid ones.
+ */
+#define OCAD_COMPACT_REFRESH_RECTS 1
+
+/** Compacts an open OCADFile like ocad_file_compact(). The new layout is computed up front from
+ *  the sizes of the entities, and the file is compacted in place when no entity would overwrite
+ *  another one before it has been moved, which is the case when entities were only appended.
+ *  Otherwise a new buffer is allocated, and the objects are copied to it on the given number of
+ *  threads, or one per processor with 0. Files mapped with ocad_file_open_mapped() are always
+ *  copied into a new buffer.
+ *
+ *  The bounding rectangles stored in the object index are kept unless they are invalid, or flags
+ *  contains OCAD_COMPACT_REFRESH_RECTS. Removed objects and unused entries are dropped from the
+ *  object index, so the handles of the objects change, see ocad_object_handle().
+ *
+ *  Returns 0 on success, -1 for an invalid or streaming file, or OCAD_OUT_OF_MEMORY; the file is
+ *  unchanged then.
+ */
+int ocad_file_compact_ex(OCADFile *pfile, int flags, u32 threads);
+
+
+/** One of the files merged into another one by ocad_file_merge().
+ */
+typedef
+struct _OCADMergeSource {
+	OCADFile *file;			// File to take the objects from
+	const word *symbols;	// New symbol numbers by the symbol numbers of file, 65536 of them; objects
+							// whose symbol maps to 0 are left out. NULL keeps the symbol numbers.
+	const u8 *colors;		// New color numbers by the color numbers of file, 256 of them, for the
+							// colors and symbols which are copied. NULL keeps the color numbers.
+}
+OCADMergeSource;
+
+/** Appends the objects of several files to dest. The object data is copied in pieces as large as
+ *  the objects lie together in a source, without looking at the points, and the index entries
+ *  with their bounding rectangles are copied with the pointers rebased. Symbol numbers are mapped
+ *  through the symbols table of each source, and stored in the entries and objects.
+ *
+ *  Colors and symbols which dest has no color or symbol of the same (new) number for are copied
+ *  from the source, with the color numbers in the symbols mapped through the colors table. The
+ *  colors and symbols dest already has are kept as they are.
+ *
+ *  Returns 0 on success, -1 if a file isn't valid, dest is streaming or memory mapped or one of the
+ *  sources, or OCAD_OUT_OF_MEMORY; the sources merged before are kept then.
+ */
+int ocad_file_merge(OCADFile *dest, const OCADMergeSource *sources, u32 nsources);
+
+
+/** Saves an open OCADFile to the file it was opened from. Files opened with ocad_file_open_update()
+ *  get only the changed ranges, the data behind the old end and the header written, in that order.
+ *
+ *  Returns 0 on success, or the error codes of ocad_file_save_as(); -10 for memory mapped files.
+ */
+int ocad_file_save(OCADFile *pfile);
+
+
+/** Saves an open OCADFile to the given filename. Streaming files cannot be saved.
  *
  *  Returns 0 on success, or one of the following error codes:
+ *      -1:  The file is streaming.
  *      -2:  Unable to open file for writing errno was last set by open(2).
  *      -3:  Unable to completely write data to the file. errno was last set by write(2).
  */
@@ -787,6 +1035,14 @@ int ocad_export_file(OCADFile *pfile, const char *filename, void *options);
 bool ocad_setup_world_matrix(OCADFile *pfile, Transform *matrix);
 
 
+/** Fills in the provided matrix with a transformation from real-world coordinates (easting and
+ *  northing in meters) to map coordinates, using the offset, scale and angle in the setup. This
+ *  is the matrix expected by ocad_path_from_world(). Returns FALSE if the file is invalid or the
+ *  scale is not set.
+ */
+bool ocad_setup_map_matrix(OCADFile *pfile, Transform *matrix);
+
+
 /** Returns the number of colors defined in the color table, or -1 if the file isn't valid.
  */
 int ocad_color_count(OCADFile *pfile);
@@ -850,7 +1106,9 @@ OCADSymbolIndex *ocad_symidx_next(OCADFile *pfile, OCADSymbolIndex *current);
 int ocad_symbol_count(OCADFile *pfile);
 
 
-/** Adds a new symbol with the given size in bytes to the file and returns a pointer to the new symbol.
+/** Adds a new symbol with the given size in bytes to the file and returns a pointer to the new symbol,
+ *  or NULL if there is not enough memory. The caller sets the symbol number, which must not change
+ *  once another symbol has been added or looked up.
  */
 OCADSymbol *ocad_symbol_new(OCADFile *pfile, int size);
 
@@ -861,7 +1119,10 @@ OCADSymbol *ocad_symbol_new(OCADFile *pfile, int size);
 OCADSymbol *ocad_symbol_at(OCADFile *pfile, OCADSymbolIndex *current, int index);
 
 
-/** Finds the symbol with a particular number, or NULL if no such symbol exists.
+/** Finds the symbol with a particular number, or NULL if no such symbol exists. If several symbols
+ *  have the number, the first one in the symbol index is returned.
+ *
+ *  The lookup goes through a table indexed by symbol number, which is built on the first call.
  */
 OCADSymbol *ocad_symbol(OCADFile *pfile, word number);
 
@@ -923,10 +1184,20 @@ OCADObjectEntry *ocad_object_entry_at(OCADFile *pfile, OCADObjectIndex *current,
 void ocad_object_entry_refresh(OCADFile *pfile, OCADObjectEntry *entry, OCADObject *object);
 
 
-/** Returns a pointer to the first empty object index entry large enough to fit an object with the
- *  given number of points. If no suitable object index entry is found, a new entry will be created.
- *  This method will only return NULL if the file isn't valid or if there is a memory allocation
- *  problem.
+/** Returns a pointer to an empty object index entry large enough to fit an object with the given
+ *  number of points. If no suitable object index entry is found, a new entry will be created.
+ *  This method will only return NULL if the file isn't valid, if npts is zero or more than
+ *  OCAD_MAX_OBJECT_PTS, or if there is a memory allocation problem.
+ *
+ *  Removed objects are kept in free lists by size class, so the space of one of them is reused
+ *  in constant time if it has room for npts points and at most about twice as much. Failing
+ *  that, an unused entry in front of the last used one gets new space, or the entry is taken from
+ *  the tail of the last index block. The free lists are built by walking the index once, on the
+ *  first call after the file was opened or compacted.
+ *
+ *  If the space of removed objects exceeds the threshold set by ocad_file_set_auto_compact(), and
+ *  no removed object can be reused, the file is compacted first; this moves all objects and index
+ *  entries.
  *
  *  The returned entry will have its ptr and npts fields set; the caller is responsible for writing
  *  the object into the location pointed to by ptr, and setting the symbol, min, and max fields in
@@ -936,14 +1207,87 @@ void ocad_object_entry_refresh(OCADFile *pfile, OCADObjectEntry *entry, OCADObje
 OCADObjectEntry *ocad_object_entry_new(OCADFile *pfile, u32 npts);
 
 
+/** Returns the next unused entry at the end of the object index, starting a new index block when
+ *  the last one is full. Unlike ocad_object_entry_new(), unused entries in front of the end aren't
+ *  reused and no space is allocated for the object; the caller fills in the whole entry. The file
+ *  buffer only moves when a new index block doesn't fit into the reserved space. Returns NULL if
+ *  the file isn't valid, has no object index block or there is a memory allocation problem.
+ */
+OCADObjectEntry *ocad_object_entry_append(OCADFile *pfile);
+
+
 /** Removes the object at the given object index entry. Returns 0 on success, -1 if the file isn't
  *  valid. The object's symbol number is set to zero, and the entry's symbol number is set to zero.
- *  The entry becomes eligible to be returned by a call to ocad_object_entry_new(), if it is large
- *  enough for the new object.
+ *  The entry goes into the free list for its size, from which ocad_object_entry_new() takes it for
+ *  an object that fits.
  */
 int ocad_object_remove(OCADFile *pfile, OCADObjectEntry *entry);
 
 
+/** Returns the handle of an object index entry: the number of its index block, counting from 0
+ *  in index order, times 256 plus its position in the block. Handles stay the same while objects
+ *  are added, removed and replaced, until the file is compacted. Returns -1 if the entry isn't
+ *  in the object index of the file.
+ */
+s32 ocad_object_handle(OCADFile *pfile, const OCADObjectEntry *entry);
+
+
+/** Returns the object index entry with the given handle in constant time, or NULL if there is no
+ *  such entry in use. Also returns NULL for streaming files, whose index has mostly been written
+ *  out. The entry of a removed object is returned too; its symbol number is zero.
+ */
+OCADObjectEntry *ocad_object_entry_by_handle(OCADFile *pfile, s32 handle);
+
+
+/** Makes room for npts points in the object of the given entry, for rewriting it in place. The
+ *  object stays where it is if it has room, or if it is the last one in the file buffer, which
+ *  then grows. Otherwise it moves into the space of a removed object which fits, or else to new
+ *  space at the end of the file; the old space goes to the free lists like that of a removed
+ *  object. Objects of a file opened with ocad_file_open_update() which are still on disk always
+ *  move. The entry itself stays in place, so its handle doesn't change.
+ *
+ *  Like ocad_object_new(), this returns the object with its header zeroed and npts set, and the
+ *  entry in out_entry, since the file buffer may have moved. The caller writes the object and then
+ *  calls ocad_object_entry_refresh(). Returns NULL if npts is zero or more than
+ *  OCAD_MAX_OBJECT_PTS, if the entry holds no object, if the file is streaming or there is a
+ *  memory allocation problem; the object is unchanged then.
+ */
+OCADObject *ocad_object_renew(OCADFile *file, OCADObjectEntry *entry, u32 npts, OCADObjectEntry** out_entry);
+
+
+/** Replaces the object of the given entry by a copy of another one, which may have a different
+ *  number of points; see ocad_object_renew() for where it goes. Returns a pointer to the new
+ *  object, with its entry in out_entry, or NULL if it could not be replaced.
+ */
+OCADObject *ocad_object_replace(OCADFile *file, OCADObjectEntry *entry, const OCADObject *object, OCADObjectEntry** out_entry);
+
+
+/** Statistics about the space of removed objects, see ocad_object_free_stats().
+ */
+typedef
+struct _OCADObjectFreeStats {
+	u32 free_slots;		// Removed objects whose space can be reused
+	u32 free_entries;	// Unused index entries without space of their own
+	u64 free_bytes;		// Size of the space of the removed objects
+	u32 file_size;		// Size of the file
+	u32 percent;		// free_bytes as a percentage of the file size
+	u32 slots[OCAD_FREE_CLASSES];	// Removed objects by size class, see OCAD_FREE_CLASSES
+}
+OCADObjectFreeStats;
+
+/** Fills in statistics about the fragmentation of a file by removed objects. Returns 0 on
+ *  success, or -1 if the file isn't valid or has no object index.
+ */
+int ocad_object_free_stats(OCADFile *pfile, OCADObjectFreeStats *stats);
+
+
+/** Lets ocad_object_entry_new() compact the file when the space of removed objects reaches the
+ *  given percentage of the file size, and at least 64 KiB. A percentage of 0 turns this off, which
+ *  is the default. Streaming and memory mapped files are never compacted.
+ */
+void ocad_file_set_auto_compact(OCADFile *pfile, u32 percent);
+
+
 /** Iterates over all object entries in the file.
  */
 bool ocad_object_entry_iterate(OCADFile *pfile, OCADObjectEntryCallback callback, void *param);
@@ -976,6 +1320,12 @@ u32 ocad_object_size(const OCADObject *object);
 u32 ocad_object_size_npts(u32 npts);
 
 
+/** Returns the number of bytes which are needed to add nobjects new objects with a total of npts
+ *  points to a file, including the object index blocks for them.
+ */
+u32 ocad_object_storage_size(u32 nobjects, u32 npts);
+
+
 /** Allocates space for a temporary OCAD object, optionally copying it from an existing object. The
  *  allocated space is the size of the largest object supported by the file format (32767 points).
  *  This object can then be manipulated with the ocad_object_* functions, and finally saved back into
@@ -995,6 +1345,27 @@ OCADObject *ocad_object_alloc(const OCADObject *source);
  */
 OCADObject *ocad_object_add(OCADFile *file, const OCADObject *object, OCADObjectEntry** out_entry);
 
+
+/** Adds a new, empty object with room for npts points directly in the file buffer, without the
+ *  temporary copy used by ocad_object_add(). The object header is zeroed and its npts field is set.
+ *  The caller writes the points and the remaining header fields into the returned object, and then
+ *  calls ocad_object_entry_refresh() with the entry returned in out_entry. The caller may lower
+ *  npts before the refresh, but must not raise it.
+ *
+ *  The returned pointer is invalidated by the next call which grows the file buffer. Returns NULL if
+ *  npts is zero or more than OCAD_MAX_OBJECT_PTS, the file isn't valid or there is a memory
+ *  allocation problem.
+ */
+OCADObject *ocad_object_new(OCADFile *file, u32 npts, OCADObjectEntry** out_entry);
+
+
+/** Gives back the space of an object whose npts was lowered after ocad_object_new(), if the object
+ *  is the last one in the file buffer; the entry's npts is lowered to match. Otherwise the entry
+ *  keeps its size, and the unused space is reused when the entry is.
+ */
+void ocad_object_trim(OCADFile *file, OCADObjectEntry *entry);
+
+
 /** Returns a pointer to the first string index block, or NULL if the file isn't valid. Also returns
  *  NULL if the file contains no object.
  */
@@ -1051,7 +1422,9 @@ OCADCString *ocad_string(OCADFile *pfile, OCADStringEntry *entry);
 int ocad_string_add_background(OCADFile *pfile, OCADBackground *bg);
 
 
-/** Initializes an OCADPaintData object suitable for the given file.
+/** Initializes an OCADPaintData object suitable for the given file. The colors used by each symbol
+ *  are gathered here, so the object has to be initialized again after colors or symbols change.
+ *  Returns 0 on success, or OCAD_OUT_OF_MEMORY.
  */
 int ocad_paint_data_init(OCADFile *pfile, OCADPaintData *data);
 
@@ -1061,11 +1434,13 @@ int ocad_paint_data_init(OCADFile *pfile, OCADPaintData *data);
 int ocad_paint_data_free(OCADPaintData *data);
 
 
-/** Initializes the given OCADPaintData object and fills it with references to all objects intersecting
- *  the specified rectangle. The rectangle may be NULL to indicate no spatial filtering.
+/** Fills the given OCADPaintData object, initialized by ocad_paint_data_init(), with references to all
+ *  objects intersecting the specified rectangle. The rectangle may be NULL to indicate no spatial filtering.
  *
  *  If this call completes successfully, then the OCADPaintData object can be passed to ocad_paint().
- *  The object can be cached and used for later calls to ocad_paint(), if desired.
+ *  The object can be cached and used for later calls to ocad_paint(), if desired. Filling it again
+ *  for another rectangle reuses its memory, and finds the objects with the spatial index of the file.
+ *  If memory is exhausted, the object is left empty.
  */
 void ocad_paint_data_fill(OCADPaintData *pdata, const OCADRect *rect);
 
@@ -1100,6 +1475,48 @@ bool ocad_paint(const OCADPaintData *pdata, OCADPaintCallback *callback, void *p
 void ocad_rect_union(OCADRect *into, const OCADRect *other);
 
 
+/** Builds the spatial index of the file, a packed R-tree over the rectangles of all object index
+ *  entries, unless it has already been built. The index is kept with the file until objects are
+ *  added, removed or refreshed, or the file is compacted; the next query then builds it again.
+ *  Building it up front is only needed to keep the time out of the first query, or before several
+ *  threads query the file.
+ *
+ *  Returns the index, or NULL if memory is exhausted.
+ */
+OCADSpatialIndex *ocad_spatial_build(OCADFile *pfile);
+
+
+/** Drops the spatial index of the file. This is called by the functions which change object index
+ *  entries, and only needs to be called directly after changing the rectangle of an entry by hand.
+ */
+void ocad_spatial_invalidate(OCADFile *pfile);
+
+
+/** Frees a spatial index. Files free their index themselves.
+ */
+void ocad_spatial_free(OCADSpatialIndex *index);
+
+
+/** Calculates the bounding rectangle of all objects from the spatial index. Returns FALSE if there
+ *  are no objects or memory is exhausted.
+ */
+bool ocad_spatial_bounds(OCADFile *pfile, OCADRect *rect);
+
+
+/** Calls the callback for all objects whose rectangle intersects the given rectangle, in the
+ *  order of the index. Returns FALSE if the callback aborted the iteration or memory is exhausted.
+ */
+bool ocad_spatial_iterate(OCADFile *pfile, const OCADRect *rect, OCADObjectEntryCallback callback, void *param);
+
+
+/** Finds the k objects whose rectangles are nearest to the given point, and stores their entries
+ *  into the entries array ordered by distance. If distances isn't NULL, the distances in map units
+ *  are stored there; points in a rectangle have the distance 0. Returns the number of entries
+ *  found, which is less than k only if the file has fewer objects.
+ */
+u32 ocad_spatial_nearest(OCADFile *pfile, const OCADPoint *pt, u32 k, OCADObjectEntry **entries, double *distances);
+
+
 // Debugging function
 void dump_bytes(u8 *base, u32 size);
 
@@ -33,17 +33,22 @@ SOURCES = \
   array.c \
   geometry.c \
   path.c \
+  bezier.c \
   file.c \
+  merge.c \
   color.c \
   setup.c \
   ocad_symbol.c \
   ocad_object.c \
+  spatial.c \
+  paint.c \
   string.c
 
 LIBOCD_PRI = \
   "$$LITERAL_HASH Generated by $$_PRO_FILE_" \
   "DEPENDPATH  += $$PWD" \
   "INCLUDEPATH += $$PWD" \
-  "LIBS        += \"-L$$OUT_PWD\""
+  "LIBS        += \"-L$$OUT_PWD\"" \
+  "unix:LIBS   += -lpthread"
 
 write_file($$OUT_PWD/libocd.pri, LIBOCD_PRI)
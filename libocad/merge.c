@@ -0,0 +1,217 @@
+/*
+ *    Copyright 2012 Peter Curtis
+ *
+ *    This file is part of libocad.
+ *
+ *    libocad is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libocad is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libocad.h"
+
+static s16 ocad_merge_color(const u8 *colors, s16 number) {
+	return (number >= 0 && number < 256) ? (s16)colors[number] : number;
+}
+
+static bool ocad_merge_element_cb(void *param, OCADSymbolElement *element) {
+	element->color = ocad_merge_color((const u8 *)param, element->color);
+	return TRUE;
+}
+
+/** Renumbers the colors used by a copied symbol: the colors of its parts, and its color bitmask.
+ */
+static void ocad_merge_symbol_colors(OCADSymbol *symbol, const u8 *colors) {
+	u8 mask[32];
+	int c;
+	memset(mask, 0, sizeof(mask));
+	for (c = 0; c < 256; c++) {
+		if (symbol->colors[c / 8] & (0x1 << (c % 8))) mask[colors[c] / 8] |= (u8)(0x1 << (colors[c] % 8));
+	}
+	memcpy(symbol->colors, mask, sizeof(mask));
+	switch (symbol->type) {
+	case OCAD_POINT_SYMBOL: {
+		OCADPointSymbol *point = (OCADPointSymbol *)symbol;
+		ocad_symbol_element_iterate(point->ngrp, point->pts, ocad_merge_element_cb, (void *)colors);
+		break;
+	}
+	case OCAD_LINE_SYMBOL: {
+		OCADLineSymbol *line = (OCADLineSymbol *)symbol;
+		s16 ngrp = line->smnpts + line->ssnpts + line->scnpts + line->sbnpts + line->senpts;
+		line->color = (u16)ocad_merge_color(colors, (s16)line->color);
+		line->dcolor = ocad_merge_color(colors, line->dcolor);
+		line->lcolor = ocad_merge_color(colors, line->lcolor);
+		line->rcolor = ocad_merge_color(colors, line->rcolor);
+		line->fcolor = ocad_merge_color(colors, line->fcolor);
+		if (ngrp > 0) ocad_symbol_element_iterate(ngrp, line->pts, ocad_merge_element_cb, (void *)colors);
+		break;
+	}
+	case OCAD_AREA_SYMBOL: {
+		OCADAreaSymbol *area = (OCADAreaSymbol *)symbol;
+		area->color = ocad_merge_color(colors, area->color);
+		area->hcolor = ocad_merge_color(colors, area->hcolor);
+		if (area->npts > 0) ocad_symbol_element_iterate(area->npts, area->pts, ocad_merge_element_cb, (void *)colors);
+		break;
+	}
+	case OCAD_TEXT_SYMBOL: {
+		OCADTextSymbol *text = (OCADTextSymbol *)symbol;
+		text->color = ocad_merge_color(colors, text->color);
+		text->ucolor = ocad_merge_color(colors, text->ucolor);
+		text->fcolor = ocad_merge_color(colors, text->fcolor);
+		break;
+	}
+	case OCAD_RECT_SYMBOL: {
+		OCADRectSymbol *rect = (OCADRectSymbol *)symbol;
+		rect->color = ocad_merge_color(colors, rect->color);
+		rect->gcolor = ocad_merge_color(colors, rect->gcolor);
+		break;
+	}
+	}
+}
+
+/** Adds the colors of a source which the destination doesn't have yet, under their new numbers.
+ */
+static void ocad_merge_colors(OCADFile *dest, const OCADMergeSource *source) {
+	OCADFile *src = source->file;
+	int i;
+	for (i = 0; i < src->header->ncolors && i < 256; i++) {
+		u8 number = (u8)src->colors[i].number;
+		OCADColor *color;
+		if (source->colors) number = source->colors[number];
+		if (ocad_color(dest, number) != NULL || dest->header->ncolors >= 256) continue;
+		color = dest->colors + dest->header->ncolors++;
+		*color = src->colors[i];
+		color->number = number;
+		ocad_file_touch(dest, color, sizeof(OCADColor));
+	}
+}
+
+/** Copies the symbols of a source which the destination doesn't have yet, under their new numbers
+ *  and with their colors renumbered. Returns FALSE if there is no memory for a symbol.
+ */
+static bool ocad_merge_symbols(OCADFile *dest, const OCADMergeSource *source) {
+	OCADFile *src = source->file;
+	OCADSymbolIndex *idx;
+	int i;
+	for (idx = ocad_symidx_first(src); idx != NULL; idx = ocad_symidx_next(src, idx)) {
+		for (i = 0; i < 256; i++) {
+			OCADSymbol *symbol = ocad_symbol_at(src, idx, i), *copy;
+			word number;
+			if (symbol == NULL || symbol->size <= 0) continue;
+			number = source->symbols ? source->symbols[(word)symbol->number] : (word)symbol->number;
+			if (number == 0 || ocad_symbol(dest, number) != NULL) continue;
+			copy = ocad_symbol_new(dest, symbol->size);
+			if (copy == NULL) return FALSE;
+			memcpy(copy, symbol, symbol->size);
+			copy->number = (s16)number;
+			if (source->colors) ocad_merge_symbol_colors(copy, source->colors);
+		}
+	}
+	return TRUE;
+}
+
+static word ocad_merge_symbol(const OCADMergeSource *source, const OCADObjectEntry *entry) {
+	if (entry->ptr == 0 || entry->symbol == 0 || entry->npts == 0) return 0;
+	return source->symbols ? source->symbols[entry->symbol] : entry->symbol;
+}
+
+/** Copies the objects of a source behind the end of the destination. The data of objects which
+ *  follow each other in the source is copied in one piece, and the entries are copied with their
+ *  pointers moved by the distance of the pieces.
+ */
+static int ocad_merge_objects(OCADFile *dest, const OCADMergeSource *source) {
+	OCADFile *src = source->file;
+	OCADObjectIndex *idx;
+	u64 bytes = 0, reserve;
+	u32 count = 0, run_len = 0, i;
+	dword base, pos, run_src = 0, run_dest = 0;
+
+	// The space for all objects and their index blocks is reserved up front, so the destination
+	// buffer doesn't move while the entries are written
+	for (idx = ocad_objidx_first(src); idx != NULL; idx = ocad_objidx_next(src, idx)) {
+		for (i = 0; i < 256; i++) {
+			const OCADObjectEntry *entry = &idx->entry[i];
+			if (ocad_merge_symbol(source, entry) == 0) continue;
+			if ((u64)entry->ptr + ocad_object_size_npts(entry->npts) > src->size) continue;
+			bytes += ocad_object_size_npts(entry->npts);
+			count++;
+		}
+	}
+	if (count == 0) return 0;
+	reserve = bytes + (u64)(count / 256 + 2) * sizeof(OCADObjectIndex);
+	if ((u64)dest->size + reserve > 0xFFFFFFFFu) return OCAD_OUT_OF_MEMORY;
+	if (ocad_file_reserve(dest, (u32)reserve) == OCAD_OUT_OF_MEMORY) return OCAD_OUT_OF_MEMORY;
+	base = dest->size;
+	dest->size += (u32)bytes;
+
+	pos = base;
+	for (idx = ocad_objidx_first(src); idx != NULL; idx = ocad_objidx_next(src, idx)) {
+		for (i = 0; i < 256; i++) {
+			const OCADObjectEntry *entry = &idx->entry[i];
+			word number = ocad_merge_symbol(source, entry);
+			u32 size = ocad_object_size_npts(entry->npts);
+			OCADObjectEntry *copy;
+			if (number == 0 || (u64)entry->ptr + size > src->size) continue;
+			if (entry->ptr != run_src + run_len) {
+				if (run_len > 0) memcpy(dest->buffer + run_dest, src->buffer + run_src, run_len);
+				run_src = entry->ptr;
+				run_dest = pos;
+				run_len = 0;
+			}
+			copy = ocad_object_entry_append(dest);
+			if (copy == NULL) return OCAD_OUT_OF_MEMORY; // can't happen, the space is reserved
+			*copy = *entry;
+			copy->ptr = pos;
+			copy->symbol = number;
+			run_len += size;
+			pos += size;
+		}
+	}
+	if (run_len > 0) memcpy(dest->buffer + run_dest, src->buffer + run_src, run_len);
+
+	// Renumbered symbols are also stored in the objects
+	if (source->symbols) {
+		pos = base;
+		for (idx = ocad_objidx_first(src); idx != NULL; idx = ocad_objidx_next(src, idx)) {
+			for (i = 0; i < 256; i++) {
+				const OCADObjectEntry *entry = &idx->entry[i];
+				word number = ocad_merge_symbol(source, entry);
+				u32 size = ocad_object_size_npts(entry->npts);
+				if (number == 0 || (u64)entry->ptr + size > src->size) continue;
+				((OCADObject *)(dest->buffer + pos))->symbol = (s16)number;
+				pos += size;
+			}
+		}
+	}
+	return 0;
+}
+
+int ocad_file_merge(OCADFile *dest, const OCADMergeSource *sources, u32 nsources) {
+	u32 k;
+	int err;
+	if (!dest->header || dest->head_size != 0) return -1;
+	if (dest->storage == OCAD_STORAGE_MAPPED) return -1;
+	for (k = 0; k < nsources; k++) {
+		if (sources[k].file == dest || !sources[k].file->header || sources[k].file->head_size != 0) return -1;
+	}
+	ocad_spatial_invalidate(dest);
+	for (k = 0; k < nsources; k++) {
+		ocad_merge_colors(dest, &sources[k]);
+		if (!ocad_merge_symbols(dest, &sources[k])) return OCAD_OUT_OF_MEMORY;
+		err = ocad_merge_objects(dest, &sources[k]);
+		if (err != 0) return err;
+	}
+	return 0;
+}
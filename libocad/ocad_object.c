@@ -17,6 +17,7 @@
  *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -31,7 +32,7 @@ static dword ocad_alloc_object(OCADFile *pfile, u32 num_coords) {
 	if (ocad_file_reserve(pfile, size) == OCAD_OUT_OF_MEMORY)
 		return 0;
 	index = pfile->size;
-	object = (OCADObject*)(pfile->buffer + index);
+	object = (OCADObject *)ocad_file_ptr(pfile, index);
 	object->npts = num_coords;
 	pfile->size += size;
 	
@@ -43,7 +44,7 @@ static bool ocad_object_copy(OCADObject *dest, const OCADObject *src) {
 	u32 dsize = ocad_object_size(dest);
 	if (dsize < ssize) return FALSE;
 	memcpy(dest, src, ssize);
-	memset(dest + ssize, 0, dsize - ssize);
+	memset((u8 *)dest + ssize, 0, dsize - ssize);
 	return TRUE;
 }
 
@@ -54,7 +55,7 @@ OCADObjectIndex *ocad_objidx_first(OCADFile *pfile) {
 	if (!pfile->header) return NULL;
 	offs = pfile->header->oobjidx;
 	if (offs == 0) return NULL;
-	return (OCADObjectIndex *)(pfile->buffer + offs);
+	return (OCADObjectIndex *)ocad_file_ptr(pfile, offs);
 }
 
 OCADObjectIndex *ocad_objidx_next(OCADFile *pfile, OCADObjectIndex *current) {
@@ -62,7 +63,7 @@ OCADObjectIndex *ocad_objidx_next(OCADFile *pfile, OCADObjectIndex *current) {
 	if (!pfile->header || !current) return NULL;
 	offs = current->next;
 	if (offs == 0) return NULL;
-	return (OCADObjectIndex *)(pfile->buffer + offs);
+	return (OCADObjectIndex *)ocad_file_ptr(pfile, offs);
 }
 
 OCADObjectEntry *ocad_object_entry_at(OCADFile *pfile, OCADObjectIndex *current, int index) {
@@ -71,45 +72,200 @@ OCADObjectEntry *ocad_object_entry_at(OCADFile *pfile, OCADObjectIndex *current,
 	return &(current->entry[index]);
 }
 
-OCADObjectEntry *ocad_object_entry_new(OCADFile *pfile, u32 npts) {
-	OCADObjectEntry *empty = NULL; 
+// Compaction is only triggered automatically once removed objects take up at least this much space
+#define OCAD_AUTO_COMPACT_MIN_BYTES 0x10000
+
+/** Returns the size class of a removed object with room for npts points. Below 4 points each
+ *  size has its own class; above, each power of two is split into four classes by the two bits
+ *  after the leading one.
+ */
+static int ocad_free_class(u32 npts) {
+	int e = 2;
+	if (npts < 4) return (int)npts;
+	while ((npts >> (e + 1)) != 0) e++;
+	return 4 * (e - 1) + (int)((npts >> (e - 2)) & 3);
+}
+
+static bool ocad_free_push(OCADFreeList *list, dword offs) {
+	if (list->count == list->capacity) {
+		u32 capacity = list->capacity ? list->capacity * 2 : 64;
+		dword *entries = (dword *)realloc(list->entries, capacity * sizeof(dword));
+		if (entries == NULL) return FALSE;
+		list->entries = entries;
+		list->capacity = capacity;
+	}
+	list->entries[list->count++] = offs;
+	return TRUE;
+}
+
+/** Puts a removed or unused entry in front of the tail into the matching free list. If there is
+ *  no memory for that, the entry stays unused until the file is compacted. The space of objects
+ *  which are still on disk in a file opened for update isn't reused, only their entry.
+ */
+static void ocad_free_add(OCADFile *pfile, OCADObjectEntry *entry) {
+	dword offs = ocad_file_offset(pfile, entry);
+	if (entry->ptr != 0 && entry->npts != 0 && entry->ptr >= pfile->update_size) {
+		if (ocad_free_push(&pfile->free_slots[ocad_free_class(entry->npts)], offs)) {
+			pfile->free_bytes += ocad_object_size_npts(entry->npts);
+		}
+	}
+	else {
+		ocad_free_push(&pfile->free_entries, offs);
+	}
+}
+
+/** Takes a removed entry with room for npts points from the free lists: one of the last few
+ *  entries of the own size class which is large enough, or else the last one of the next larger
+ *  classes, all of whose entries fit. Classes which would waste more than half of the space are
+ *  not used. Returns NULL if there is none.
+ */
+static OCADObjectEntry *ocad_free_take(OCADFile *pfile, u32 npts) {
+	int k = ocad_free_class(npts), c;
+	for (c = k; c <= k + 4 && c < OCAD_FREE_CLASSES; c++) {
+		OCADFreeList *list = &pfile->free_slots[c];
+		u32 i, stop = (c == k && list->count > 4) ? list->count - 4 : 0;
+		for (i = list->count; i > stop; i--) {
+			OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, list->entries[i - 1]);
+			if (entry->npts < npts) continue;
+			list->entries[i - 1] = list->entries[--list->count];
+			pfile->free_bytes -= ocad_object_size_npts(entry->npts);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static bool ocad_objidx_add_block(OCADFile *pfile, dword offs) {
+	if (pfile->objidx_nblocks == pfile->objidx_blocks_capacity) {
+		u32 capacity = pfile->objidx_blocks_capacity ? pfile->objidx_blocks_capacity * 2 : 64;
+		dword *blocks = (dword *)realloc(pfile->objidx_blocks, capacity * sizeof(dword));
+		if (blocks == NULL) return FALSE;
+		pfile->objidx_blocks = blocks;
+		pfile->objidx_blocks_capacity = capacity;
+	}
+	pfile->objidx_blocks[pfile->objidx_nblocks++] = offs;
+	return TRUE;
+}
+
+/** Locates the last object index block and the first unused entry in it, and puts the removed
+ *  and unused entries in front of that position into the free lists. This walks the whole index
+ *  once; afterwards the tail cursor and the free lists are kept up to date by
+ *  ocad_object_entry_new() and ocad_object_remove(). Returns FALSE if the file has no object
+ *  index block. The offsets of the blocks are collected for looking up handles.
+ */
+static bool ocad_objidx_scan(OCADFile *pfile) {
 	OCADObjectIndex *idx;
-	dword offs;
-	u32 last_idx_offset = 0;
-	u32 empty_offset = 0; // holder for offset of first empty (npts=0) index entry, if needed
-	
-	if (!pfile->header) return NULL;
-	if (npts == 0) return NULL;
+	int k;
+	pfile->objidx_tail = 0;
+	pfile->objidx_nblocks = 0;
+	for (k = 0; k < OCAD_FREE_CLASSES; k++) pfile->free_slots[k].count = 0;
+	pfile->free_entries.count = 0;
+	pfile->free_bytes = 0;
 	for (idx = ocad_objidx_first(pfile); idx != NULL; idx = ocad_objidx_next(pfile, idx)) {
-		int i;
-		last_idx_offset = (u8*)idx - pfile->buffer;
-		for (i = 0; i < 256; i++) {
-			OCADObjectEntry *entry = &(idx->entry[i]);
-			if (entry->symbol == 0) {
-				if (entry->npts == 0 && empty_offset == 0) empty_offset = (u8*)&idx->entry[i] - pfile->buffer;
-				else if (entry->npts >= npts) return entry;
+		int i, used = 256;
+		if (idx->next == 0) {
+			// entries behind the last used one in the last block are the tail
+			for (used = 0, i = 0; i < 256; i++) {
+				OCADObjectEntry *entry = &(idx->entry[i]);
+				if (entry->symbol != 0 || entry->npts != 0 || entry->ptr != 0) used = i + 1;
 			}
+			pfile->objidx_tail_count = used;
+		}
+		for (i = 0; i < used; i++) {
+			if (idx->entry[i].symbol == 0) ocad_free_add(pfile, &idx->entry[i]);
+		}
+		pfile->objidx_tail = ocad_file_offset(pfile, idx);
+		if (!ocad_objidx_add_block(pfile, pfile->objidx_tail)) {
+			pfile->objidx_tail = 0;
+			return FALSE;
 		}
 	}
+	return pfile->objidx_tail != 0;
+}
 
-	if (empty_offset == 0) {
-		// We don't have any empty entries - need to create a new one!
-		if (last_idx_offset == 0) return NULL; // we don't support adding objects to files without object index block
-		ocad_file_reserve(pfile, sizeof(OCADObjectIndex));
-		idx = (OCADObjectIndex*)(pfile->buffer + last_idx_offset);
+/** Compacts the file if the space of removed objects has reached the threshold. Returns TRUE if
+ *  the file was compacted.
+ */
+static bool ocad_object_auto_compact(OCADFile *pfile) {
+	if (pfile->compact_threshold == 0 || pfile->head_size != 0) return FALSE;
+	if (pfile->storage != OCAD_STORAGE_MALLOC && pfile->storage != OCAD_STORAGE_VIRTUAL) return FALSE;
+	if (pfile->free_bytes < OCAD_AUTO_COMPACT_MIN_BYTES) return FALSE;
+	if (pfile->free_bytes * 100 < (u64)pfile->compact_threshold * pfile->size) return FALSE;
+	if (ocad_file_compact_ex(pfile, 0, 0) != 0) return FALSE;
+	return ocad_objidx_scan(pfile);
+}
+
+OCADObjectEntry *ocad_object_entry_append(OCADFile *pfile) {
+	OCADObjectIndex *idx;
+	OCADObjectEntry *entry;
+	if (!pfile->header) return NULL;
+	if (pfile->objidx_tail == 0 && !ocad_objidx_scan(pfile)) return NULL;
+	if (pfile->objidx_tail_count == 256) {
+		// The last index block is full - need to create a new one!
+		if (ocad_file_reserve(pfile, sizeof(OCADObjectIndex)) == OCAD_OUT_OF_MEMORY) return NULL;
+		idx = (OCADObjectIndex *)ocad_file_ptr(pfile, pfile->objidx_tail);
 		idx->next = pfile->size;
-		idx = (OCADObjectIndex*)(pfile->buffer + pfile->size);
+		ocad_file_touch(pfile, &idx->next, sizeof(dword));
+		pfile->objidx_tail = pfile->size;
+		pfile->objidx_tail_count = 0;
 		pfile->size += sizeof(OCADObjectIndex);
-		empty_offset = (u8*)&idx->entry[0] - pfile->buffer;
+		if (!ocad_objidx_add_block(pfile, pfile->objidx_tail)) {
+			pfile->objidx_tail = 0; // the next call scans the index again
+			return NULL;
+		}
+		// Everything in front of the new block is complete now
+		if (ocad_file_stream_flush(pfile, pfile->objidx_tail) != 0) return NULL;
+	}
+	idx = (OCADObjectIndex *)ocad_file_ptr(pfile, pfile->objidx_tail);
+	entry = &idx->entry[pfile->objidx_tail_count++];
+	ocad_file_touch(pfile, entry, sizeof(OCADObjectEntry));
+	return entry;
+}
+
+OCADObjectEntry *ocad_object_entry_new(OCADFile *pfile, u32 npts) {
+	OCADObjectEntry *empty = NULL;
+	dword offs;
+	u32 empty_offset = 0; // holder for offset of the empty (npts=0) index entry to be filled
+
+	if (!pfile->header) return NULL;
+	if (npts == 0 || npts > OCAD_MAX_OBJECT_PTS) return NULL;
+	ocad_spatial_invalidate(pfile);
+	// we don't support adding objects to files without object index block
+	if (pfile->objidx_tail == 0 && !ocad_objidx_scan(pfile)) return NULL;
+
+	// Removed objects are reused if one fits, else unused entries get new space; plain appends go
+	// to the tail. Streaming files always append, since most of their index has already been
+	// written out.
+	if (pfile->head_size == 0) {
+		empty = ocad_free_take(pfile, npts);
+		if (empty != NULL) {
+			ocad_file_touch(pfile, empty, sizeof(OCADObjectEntry));
+			return empty;
+		}
+		ocad_object_auto_compact(pfile);
+		if (pfile->free_entries.count > 0) {
+			empty_offset = pfile->free_entries.entries[--pfile->free_entries.count];
+		}
+	}
+
+	if (empty_offset == 0) {
+		empty = ocad_object_entry_append(pfile);
+		if (empty == NULL) return NULL;
+		empty_offset = ocad_file_offset(pfile, empty);
 	}
 
 	// There exists an empty index entry, with symbol=0 and npts=0. We can allocate a new object and fill it
 	offs = ocad_alloc_object(pfile, npts);
-	if (offs == 0) return NULL; // no memory
+	if (offs == 0) {
+		// no memory, the entry stays unused
+		ocad_free_push(&pfile->free_entries, empty_offset);
+		return NULL;
+	}
 
-	empty = (OCADObjectEntry*)(pfile->buffer + empty_offset);
+	empty = (OCADObjectEntry *)ocad_file_ptr(pfile, empty_offset);
 	empty->ptr = offs;
 	empty->npts = npts;
+	ocad_file_touch(pfile, empty, sizeof(OCADObjectEntry));
 	// symbol, min, and max still need to be updated by the caller!
 	return empty;
 }
@@ -117,6 +273,7 @@ OCADObjectEntry *ocad_object_entry_new(OCADFile *pfile, u32 npts) {
 void ocad_object_entry_refresh(OCADFile *pfile, OCADObjectEntry *entry, OCADObject *object) {
 	OCADRect *prect = &(entry->rect);
 	OCADSymbol *symbol;
+	ocad_spatial_invalidate(pfile);
 	if (!ocad_path_bounds_rect(prect, object->npts, object->pts)) {
 		memset(prect, 0, sizeof(OCADRect)); // Object with no points get a zeroed bounds rect
 	}
@@ -125,21 +282,169 @@ void ocad_object_entry_refresh(OCADFile *pfile, OCADObjectEntry *entry, OCADObje
 		ocad_rect_grow(prect, symbol->extent);
 	}
 	entry->symbol = object->symbol;
+	ocad_file_touch(pfile, entry, sizeof(OCADObjectEntry));
 }
 
 
 int ocad_object_remove(OCADFile *pfile, OCADObjectEntry *entry) {
 	dword offs;
 	if (entry == NULL) return -1;
+	ocad_spatial_invalidate(pfile);
+	// Until the tail has been located, the next scan finds the entry
+	if (entry->symbol != 0 && pfile->objidx_tail != 0) ocad_free_add(pfile, entry);
 	entry->symbol = 0;
+	ocad_file_touch(pfile, entry, sizeof(OCADObjectEntry));
 	offs = entry->ptr;
 	if (offs != 0) {
-		OCADObject *obj = (OCADObject *)(pfile->buffer + offs);
+		OCADObject *obj = (OCADObject *)ocad_file_ptr(pfile, offs);
 		obj->symbol = 0;
+		ocad_file_touch(pfile, &obj->symbol, sizeof(obj->symbol));
 	}
 	return 0;
 }
 
+s32 ocad_object_handle(OCADFile *pfile, const OCADObjectEntry *entry) {
+	const dword first = (dword)offsetof(OCADObjectIndex, entry);
+	const dword span = 256 * sizeof(OCADObjectEntry);
+	dword offs, *blocks;
+	u32 lo, hi, n, b;
+	if (!pfile->header || entry == NULL) return -1;
+	if (pfile->objidx_tail == 0 && !ocad_objidx_scan(pfile)) return -1;
+	offs = ocad_file_offset(pfile, entry);
+	blocks = pfile->objidx_blocks;
+	n = pfile->objidx_nblocks;
+
+	// Blocks are usually in ascending order, since they are appended; files from elsewhere may
+	// have them in any order, then they are searched one by one
+	lo = 0;
+	hi = n;
+	while (hi - lo > 1) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (blocks[mid] <= offs) lo = mid;
+		else hi = mid;
+	}
+	b = lo;
+	if (offs < blocks[b] + first || offs - blocks[b] - first >= span) {
+		for (b = 0; b < n; b++) {
+			if (offs >= blocks[b] + first && offs - blocks[b] - first < span) break;
+		}
+		if (b == n) return -1;
+	}
+	if ((offs - blocks[b] - first) % sizeof(OCADObjectEntry) != 0) return -1;
+	return (s32)(b * 256 + (offs - blocks[b] - first) / sizeof(OCADObjectEntry));
+}
+
+OCADObjectEntry *ocad_object_entry_by_handle(OCADFile *pfile, s32 handle) {
+	OCADObjectIndex *idx;
+	u32 b, i;
+	if (!pfile->header || handle < 0 || pfile->head_size != 0) return NULL;
+	if (pfile->objidx_tail == 0 && !ocad_objidx_scan(pfile)) return NULL;
+	b = (u32)handle / 256;
+	i = (u32)handle % 256;
+	if (b >= pfile->objidx_nblocks) return NULL;
+	if (pfile->objidx_blocks[b] == pfile->objidx_tail && i >= pfile->objidx_tail_count) return NULL;
+	idx = (OCADObjectIndex *)ocad_file_ptr(pfile, pfile->objidx_blocks[b]);
+	return &idx->entry[i];
+}
+
+OCADObject *ocad_object_renew(OCADFile *file, OCADObjectEntry *entry, u32 npts, OCADObjectEntry** out_entry) {
+	OCADObject *dest;
+	dword eoffs;
+	if (out_entry)
+		*out_entry = entry;
+	if (!file->header || entry == NULL || entry->ptr == 0 || entry->symbol == 0) return NULL;
+	if (npts == 0 || npts > OCAD_MAX_OBJECT_PTS || file->head_size != 0) return NULL;
+	// the free lists are needed, and removed entries must not be in them twice
+	if (file->objidx_tail == 0 && !ocad_objidx_scan(file)) return NULL;
+	ocad_spatial_invalidate(file);
+	eoffs = ocad_file_offset(file, entry);
+
+	// Objects still on disk in a file opened for update are never overwritten
+	if (npts > entry->npts || entry->ptr < file->update_size) {
+		OCADObjectEntry *slot;
+		OCADObject *old;
+		dword offs = entry->ptr;
+		u16 old_npts = entry->npts;
+		if (offs + ocad_object_size_npts(old_npts) == file->size && offs >= file->update_size) {
+			// The object is the last thing in the file, so it can grow where it is
+			u32 grow = ocad_object_size_npts(npts) - ocad_object_size_npts(old_npts);
+			if (ocad_file_reserve(file, grow) == OCAD_OUT_OF_MEMORY) return NULL;
+			file->size += grow;
+			entry = (OCADObjectEntry *)ocad_file_ptr(file, eoffs);
+			entry->npts = npts;
+		}
+		else if ((slot = ocad_free_take(file, npts)) != NULL) {
+			// The removed entry takes over the old space
+			entry->ptr = slot->ptr;
+			entry->npts = slot->npts;
+			slot->ptr = offs;
+			slot->npts = old_npts;
+			old = (OCADObject *)ocad_file_ptr(file, offs);
+			old->symbol = 0;
+			ocad_file_touch(file, &old->symbol, sizeof(old->symbol));
+			ocad_file_touch(file, slot, sizeof(OCADObjectEntry));
+			ocad_free_add(file, slot);
+		}
+		else {
+			dword noffs = ocad_alloc_object(file, npts);
+			if (noffs == 0) return NULL;
+			entry = (OCADObjectEntry *)ocad_file_ptr(file, eoffs);
+			entry->ptr = noffs;
+			entry->npts = npts;
+			old = (OCADObject *)ocad_file_ptr(file, offs);
+			old->symbol = 0;
+			ocad_file_touch(file, &old->symbol, sizeof(old->symbol));
+			// An unused entry takes over the old space if there is one, else it is lost until
+			// the file is compacted
+			if (file->free_entries.count > 0 && offs >= file->update_size) {
+				slot = (OCADObjectEntry *)ocad_file_ptr(file, file->free_entries.entries[--file->free_entries.count]);
+				slot->ptr = offs;
+				slot->npts = old_npts;
+				ocad_file_touch(file, slot, sizeof(OCADObjectEntry));
+				ocad_free_add(file, slot);
+			}
+		}
+		ocad_file_touch(file, entry, sizeof(OCADObjectEntry));
+	}
+
+	if (out_entry)
+		*out_entry = entry;
+	dest = (OCADObject *)ocad_file_ptr(file, entry->ptr);
+	memset(dest, 0, ocad_object_size_npts(0));
+	dest->npts = npts;
+	return dest;
+}
+
+OCADObject *ocad_object_replace(OCADFile *file, OCADObjectEntry *entry, const OCADObject *object, OCADObjectEntry** out_entry) {
+	OCADObject *dest = ocad_object_renew(file, entry, object->npts + object->ntext, &entry);
+	if (out_entry)
+		*out_entry = entry;
+	if (dest == NULL) return NULL;
+	if (!ocad_object_copy(dest, object)) return NULL;
+	ocad_object_entry_refresh(file, entry, dest);
+	return dest;
+}
+
+int ocad_object_free_stats(OCADFile *pfile, OCADObjectFreeStats *stats) {
+	int k;
+	if (!pfile->header) return -1;
+	if (pfile->objidx_tail == 0 && !ocad_objidx_scan(pfile)) return -1;
+	memset(stats, 0, sizeof(OCADObjectFreeStats));
+	for (k = 0; k < OCAD_FREE_CLASSES; k++) {
+		stats->slots[k] = pfile->free_slots[k].count;
+		stats->free_slots += pfile->free_slots[k].count;
+	}
+	stats->free_entries = pfile->free_entries.count;
+	stats->free_bytes = pfile->free_bytes;
+	stats->file_size = pfile->size;
+	stats->percent = pfile->size ? (u32)(pfile->free_bytes * 100 / pfile->size) : 0;
+	return 0;
+}
+
+void ocad_file_set_auto_compact(OCADFile *pfile, u32 percent) {
+	pfile->compact_threshold = (u8)(percent > 100 ? 100 : percent);
+}
+
 bool ocad_object_entry_iterate(OCADFile *pfile, OCADObjectEntryCallback callback, void *param) {
 	OCADObjectIndex *idx;
 	for (idx = ocad_objidx_first(pfile); idx != NULL; idx = ocad_objidx_next(pfile, idx)) {
@@ -162,14 +467,14 @@ OCADObject *ocad_object_at(OCADFile *pfile, OCADObjectIndex *current, int index)
 	offs = entry->ptr;
 	if (offs == 0) return NULL;
 	//fprintf(stderr, "offs=%x\n", offs);
-	return (OCADObject *)(pfile->buffer + offs);
+	return (OCADObject *)ocad_file_ptr(pfile, offs);
 }
 
 OCADObject *ocad_object(OCADFile *pfile, OCADObjectEntry *entry) {
 	if (!pfile->header) return NULL;
 	if (entry == NULL || entry->ptr == 0) return NULL;
 	if (entry->symbol == 0) return NULL;
-	return (OCADObject *)(pfile->buffer + entry->ptr);
+	return (OCADObject *)ocad_file_ptr(pfile, entry->ptr);
 }
 
 bool ocad_object_iterate(OCADFile *pfile, OCADObjectCallback callback, void *param) {
@@ -196,6 +501,13 @@ u32 ocad_object_size_npts(u32 npts) {
 	return 0x20 + 8 * npts;
 }
 
+u32 ocad_object_storage_size(u32 nobjects, u32 npts) {
+	u64 size = (u64)nobjects * ocad_object_size_npts(0) + (u64)npts * sizeof(OCADPoint)
+		+ (u64)(nobjects / 256 + 1) * sizeof(OCADObjectIndex);
+	if (size > 0xFFFFFFFFu) return 0xFFFFFFFFu;
+	return (u32)size;
+}
+
 OCADObject *ocad_object_alloc(const OCADObject *source) {
 	int size = ocad_object_size_npts(OCAD_MAX_OBJECT_PTS);
 	OCADObject *obj = (OCADObject *)malloc(size);
@@ -203,7 +515,7 @@ OCADObject *ocad_object_alloc(const OCADObject *source) {
 	if (source != NULL) {
 		int ssize = ocad_object_size(source);
 		memcpy(obj, source, ssize);
-		memset(obj + ssize, 0, size - ssize);
+		memset((u8 *)obj + ssize, 0, size - ssize);
 	}
 	else {
 		memset(obj, 0, size);
@@ -224,3 +536,29 @@ OCADObject *ocad_object_add(OCADFile *file, const OCADObject *object, OCADObject
 	return dest;
 }
 
+OCADObject *ocad_object_new(OCADFile *file, u32 npts, OCADObjectEntry** out_entry) {
+	OCADObjectEntry *entry = ocad_object_entry_new(file, npts);
+	OCADObject *dest;
+	if (out_entry)
+		*out_entry = entry;
+	if (entry == NULL) return NULL;
+	dest = (OCADObject *)ocad_file_ptr(file, entry->ptr);
+	memset(dest, 0, ocad_object_size_npts(0)); // a reused entry may still hold a removed object
+	dest->npts = npts;
+	return dest;
+}
+
+void ocad_object_trim(OCADFile *file, OCADObjectEntry *entry) {
+	OCADObject *object;
+	dword end;
+	u32 size;
+	if (entry == NULL || entry->ptr == 0) return;
+	object = (OCADObject *)ocad_file_ptr(file, entry->ptr);
+	size = ocad_object_size(object);
+	end = entry->ptr + ocad_object_size_npts(entry->npts);
+	if (end != file->size || size >= end - entry->ptr || entry->ptr < file->update_size) return;
+	// The object is the last thing in the file, so the space behind it is free again
+	memset((u8 *)object + size, 0, end - entry->ptr - size);
+	file->size = entry->ptr + size;
+	entry->npts = object->npts + object->ntext;
+}
@@ -17,6 +17,9 @@
  *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "libocad.h"
 
 OCADSymbolIndex *ocad_symidx_first(OCADFile *pfile) {
@@ -24,7 +27,7 @@ OCADSymbolIndex *ocad_symidx_first(OCADFile *pfile) {
 	if (!pfile || !pfile->header) return NULL;
 	offs = pfile->header->osymidx;
 	if (offs == 0) return NULL;
-	return (OCADSymbolIndex *)(pfile->buffer + offs);
+	return (OCADSymbolIndex *)ocad_file_ptr(pfile, offs);
 }
 
 OCADSymbolIndex *ocad_symidx_next(OCADFile *pfile, OCADSymbolIndex *current) {
@@ -32,7 +35,7 @@ OCADSymbolIndex *ocad_symidx_next(OCADFile *pfile, OCADSymbolIndex *current) {
 	if (!pfile || !pfile->header || !current) return NULL;
 	offs = current->next;
 	if (offs == 0) return NULL;
-	return (OCADSymbolIndex *)(pfile->buffer + offs);
+	return (OCADSymbolIndex *)ocad_file_ptr(pfile, offs);
 }
 
 int ocad_symbol_count(OCADFile *pfile) {
@@ -49,6 +52,50 @@ int ocad_symbol_count(OCADFile *pfile) {
 	return count;
 }
 
+/** Enters the symbol at the given offset into the lookup table, unless an earlier symbol already
+ *  has the same number.
+ */
+static void ocad_symtab_add(OCADFile *pfile, dword offs) {
+	OCADSymbol *sym = (OCADSymbol *)ocad_file_ptr(pfile, offs);
+	word number;
+	if (sym == NULL) return;
+	number = (word)sym->number;
+	if (pfile->symtab[number] == 0) pfile->symtab[number] = offs;
+}
+
+/** Fills the lookup table from the symbol index. Returns FALSE if the table can't be allocated.
+ */
+static bool ocad_symtab_build(OCADFile *pfile) {
+	OCADSymbolIndex *idx;
+	if (pfile->symtab == NULL) {
+		pfile->symtab = (dword *)calloc(65536, sizeof(dword));
+		if (pfile->symtab == NULL) return FALSE;
+	}
+	else {
+		memset(pfile->symtab, 0, 65536 * sizeof(dword));
+	}
+	for (idx = ocad_symidx_first(pfile); idx != NULL; idx = ocad_symidx_next(pfile, idx)) {
+		int i;
+		for (i = 0; i < 256; i++) {
+			if (idx->entry[i].ptr != 0) ocad_symtab_add(pfile, idx->entry[i].ptr);
+		}
+	}
+	pfile->symtab_pending = 0;
+	return TRUE;
+}
+
+/** Brings the lookup table up to date: builds it on first use, and enters the symbol added last,
+ *  whose number is filled in by the caller after ocad_symbol_new() returns.
+ */
+static bool ocad_symtab_update(OCADFile *pfile) {
+	if (pfile->symtab == NULL) return ocad_symtab_build(pfile);
+	if (pfile->symtab_pending != 0) {
+		ocad_symtab_add(pfile, pfile->symtab_pending);
+		pfile->symtab_pending = 0;
+	}
+	return TRUE;
+}
+
 OCADSymbol *ocad_symbol_new(OCADFile *pfile, int size) {
 	OCADSymbol* new_symbol;
 	OCADSymbolIndex *idx;
@@ -56,8 +103,10 @@ OCADSymbol *ocad_symbol_new(OCADFile *pfile, int size) {
 	int i;
 	bool found = FALSE;
 	
+	if (pfile->symtab != NULL) ocad_symtab_update(pfile);
+	
 	for (idx = ocad_symidx_first(pfile); idx != NULL; idx = ocad_symidx_next(pfile, idx)) {
-		last_idx_offset = (u8*)idx - pfile->buffer;
+		last_idx_offset = ocad_file_offset(pfile, idx);
 		for (i = 0; i < 256; i++) {
 			OCADSymbol *sym = ocad_symbol_at(pfile, idx, i);
 			if (sym == NULL)
@@ -72,21 +121,24 @@ OCADSymbol *ocad_symbol_new(OCADFile *pfile, int size) {
 	
 	if (idx == NULL) {
 		if (last_idx_offset == 0) return NULL; // we don't support adding symbols to files without symbol index block
-		ocad_file_reserve(pfile, sizeof(OCADSymbolIndex) + size);
-		idx = (OCADSymbolIndex*)(pfile->buffer + last_idx_offset);
+		if (ocad_file_reserve(pfile, sizeof(OCADSymbolIndex) + size) == OCAD_OUT_OF_MEMORY) return NULL;
+		idx = (OCADSymbolIndex *)ocad_file_ptr(pfile, last_idx_offset);
 		idx->next = pfile->size;
-		idx = (OCADSymbolIndex*)(pfile->buffer + pfile->size);
+		ocad_file_touch(pfile, &idx->next, sizeof(dword));
+		idx = (OCADSymbolIndex *)ocad_file_ptr(pfile, pfile->size);
 		pfile->size += sizeof(OCADSymbolIndex);
 		i = 0;
 	}
 	else {
-		last_idx_offset = (u8*)idx - pfile->buffer;
-		ocad_file_reserve(pfile, size);
-		idx = (OCADSymbolIndex*)(pfile->buffer + last_idx_offset);
+		last_idx_offset = ocad_file_offset(pfile, idx);
+		if (ocad_file_reserve(pfile, size) == OCAD_OUT_OF_MEMORY) return NULL;
+		idx = (OCADSymbolIndex *)ocad_file_ptr(pfile, last_idx_offset);
 	}
 	
-	new_symbol = (OCADSymbol*)(pfile->buffer + pfile->size);
+	new_symbol = (OCADSymbol *)ocad_file_ptr(pfile, pfile->size);
 	idx->entry[i].ptr = pfile->size;
+	ocad_file_touch(pfile, &idx->entry[i], sizeof(OCADSymbolEntry));
+	pfile->symtab_pending = pfile->size;
 	pfile->size += size;
 	return new_symbol;
 }
@@ -97,11 +149,24 @@ OCADSymbol *ocad_symbol_at(OCADFile *pfile, OCADSymbolIndex *current, int index)
 	if (index < 0 || index >= 256) return NULL;
 	offs = current->entry[index].ptr;
 	if (offs == 0) return NULL;
-	return (OCADSymbol *)(pfile->buffer + offs);
+	return (OCADSymbol *)ocad_file_ptr(pfile, offs);
 }
 
 OCADSymbol *ocad_symbol(OCADFile *pfile, word number) {
 	OCADSymbolIndex *idx;
+	OCADSymbol *sym;
+	if (ocad_symtab_update(pfile)) {
+		dword offs = pfile->symtab[number];
+		if (offs == 0) return NULL;
+		sym = (OCADSymbol *)ocad_file_ptr(pfile, offs);
+		if (sym != NULL && (word)sym->number == number) return sym;
+		// A symbol was renumbered after it had been entered, so the table is stale
+		if (ocad_symtab_build(pfile)) {
+			offs = pfile->symtab[number];
+			return (offs == 0) ? NULL : (OCADSymbol *)ocad_file_ptr(pfile, offs);
+		}
+	}
+	// Without a table, fall back to searching the index
 	for (idx = ocad_symidx_first(pfile); idx != NULL; idx = ocad_symidx_next(pfile, idx)) {
 		int i;
 		for (i = 0; i < 256; i++) {
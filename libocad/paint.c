@@ -0,0 +1,246 @@
+/*
+ *    Copyright 2012 Peter Curtis
+ *
+ *    This file is part of libocad.
+ *
+ *    libocad is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libocad is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libocad.h"
+
+/** Marks a color number in a color bitmask.
+ */
+static void ocad_paint_mask_color(u8 *mask, s16 number) {
+	if (number >= 0 && number < 256) mask[number / 8] |= (u8)(0x1 << (number % 8));
+}
+
+static bool ocad_paint_element_color_cb(void *param, OCADSymbolElement *element) {
+	ocad_paint_mask_color((u8 *)param, element->color);
+	return TRUE;
+}
+
+/** Gathers the colors used by a symbol into a bitmask. Besides the bitmask stored in the symbol,
+ *  the colors of its parts are checked, since not every writer fills in the bitmask.
+ */
+static void ocad_paint_symbol_colors(OCADSymbol *symbol, u8 *mask) {
+	memcpy(mask, symbol->colors, 32);
+	switch (symbol->type) {
+	case OCAD_POINT_SYMBOL: {
+		OCADPointSymbol *point = (OCADPointSymbol *)symbol;
+		ocad_symbol_element_iterate(point->ngrp, point->pts, ocad_paint_element_color_cb, mask);
+		break;
+	}
+	case OCAD_LINE_SYMBOL: {
+		OCADLineSymbol *line = (OCADLineSymbol *)symbol;
+		s16 ngrp = line->smnpts + line->ssnpts + line->scnpts + line->sbnpts + line->senpts;
+		if (line->width > 0) ocad_paint_mask_color(mask, line->color);
+		if (line->dmode) {
+			if (line->dflags & 1) ocad_paint_mask_color(mask, line->dcolor);
+			if (line->lwidth > 0) ocad_paint_mask_color(mask, line->lcolor);
+			if (line->rwidth > 0) ocad_paint_mask_color(mask, line->rcolor);
+		}
+		if (line->fwidth > 0) ocad_paint_mask_color(mask, line->fcolor);
+		if (ngrp > 0) ocad_symbol_element_iterate(ngrp, line->pts, ocad_paint_element_color_cb, mask);
+		break;
+	}
+	case OCAD_AREA_SYMBOL: {
+		OCADAreaSymbol *area = (OCADAreaSymbol *)symbol;
+		if (area->fill) ocad_paint_mask_color(mask, area->color);
+		if (area->hmode) ocad_paint_mask_color(mask, area->hcolor);
+		if (area->pmode && area->npts > 0) ocad_symbol_element_iterate(area->npts, area->pts, ocad_paint_element_color_cb, mask);
+		break;
+	}
+	case OCAD_TEXT_SYMBOL: {
+		OCADTextSymbol *text = (OCADTextSymbol *)symbol;
+		ocad_paint_mask_color(mask, text->color);
+		if (text->under) ocad_paint_mask_color(mask, text->ucolor);
+		break;
+	}
+	}
+}
+
+int ocad_paint_data_init(OCADFile *pfile, OCADPaintData *data) {
+	OCADPaintColorIndex *index = &data->index;
+	OCADSymbolIndex *idx;
+	u8 *masks = NULL;
+	s16 color_index[256];
+	u32 capacity = 0, count[256];
+	u32 b, c, sum;
+	int i;
+
+	memset(data, 0, sizeof(OCADPaintData));
+	data->file = pfile;
+	if (!pfile->header) return -1;
+	index->bucket = (u16 *)calloc(0x10000, sizeof(u16));
+	if (index->bucket == NULL) goto ocad_paint_data_init_1;
+
+	// One bucket per symbol, with the colors it uses
+	for (idx = ocad_symidx_first(pfile); idx != NULL; idx = ocad_symidx_next(pfile, idx)) {
+		for (i = 0; i < 256; i++) {
+			OCADSymbol *symbol = ocad_symbol_at(pfile, idx, i);
+			u16 number;
+			if (symbol == NULL) continue;
+			number = (u16)symbol->number;
+			if (index->bucket[number] != 0 || index->nsyms == 0xFFFF) continue;
+			if (index->nsyms == capacity) {
+				s16 *symbols;
+				u8 *grown;
+				capacity = capacity ? capacity * 2 : 256;
+				symbols = (s16 *)realloc(index->symbols, capacity * sizeof(s16));
+				if (symbols == NULL) goto ocad_paint_data_init_1;
+				index->symbols = symbols;
+				grown = (u8 *)realloc(masks, capacity * 32);
+				if (grown == NULL) goto ocad_paint_data_init_1;
+				masks = grown;
+			}
+			ocad_paint_symbol_colors(symbol, masks + 32 * index->nsyms);
+			index->symbols[index->nsyms++] = symbol->number;
+			index->bucket[number] = (u16)index->nsyms;
+		}
+	}
+
+	// The buckets of each color, by color index
+	for (c = 0; c < 256; c++) color_index[c] = -1;
+	for (i = 0; i < pfile->header->ncolors && i < 256; i++) {
+		u8 number = (u8)pfile->colors[i].number;
+		if (color_index[number] < 0) color_index[number] = i;
+	}
+	memset(count, 0, sizeof(count));
+	for (b = 0; b < index->nsyms; b++) {
+		for (c = 0; c < 256; c++) {
+			if ((masks[32 * b + c / 8] & (0x1 << (c % 8))) && color_index[c] >= 0) count[color_index[c]]++;
+		}
+	}
+	sum = 0;
+	for (c = 0; c < 256; c++) {
+		index->color_start[c] = sum;
+		sum += count[c];
+		count[c] = index->color_start[c];
+	}
+	index->color_start[256] = sum;
+	index->color_buckets = (u32 *)malloc((sum + 1) * sizeof(u32));
+	index->object_start = (u32 *)calloc(index->nsyms + 2, sizeof(u32));
+	if (index->color_buckets == NULL || index->object_start == NULL) goto ocad_paint_data_init_1;
+	for (b = 0; b < index->nsyms; b++) {
+		for (c = 0; c < 256; c++) {
+			if ((masks[32 * b + c / 8] & (0x1 << (c % 8))) && color_index[c] >= 0) {
+				index->color_buckets[count[color_index[c]]++] = b;
+			}
+		}
+	}
+	free(masks);
+	return 0;
+
+ocad_paint_data_init_1:
+	free(masks);
+	ocad_paint_data_free(data);
+	data->file = pfile;
+	return OCAD_OUT_OF_MEMORY;
+}
+
+int ocad_paint_data_free(OCADPaintData *data) {
+	OCADPaintColorIndex *index = &data->index;
+	free(index->symbols);
+	free(index->bucket);
+	free(index->color_buckets);
+	free(index->object_start);
+	free(index->objects);
+	free(index->scratch);
+	memset(data, 0, sizeof(OCADPaintData));
+	return 0;
+}
+
+/** Collects an object and its bucket into the scratch arrays, growing them as needed.
+ */
+static bool ocad_paint_data_collect_cb(void *param, OCADFile *pfile, OCADObjectEntry *entry) {
+	OCADPaintColorIndex *index = &((OCADPaintData *)param)->index;
+	u16 bucket = index->bucket[entry->symbol];
+	(void)pfile;
+	if (bucket == 0) return TRUE; // no such symbol, nothing to paint
+	if (index->nobjects == index->capacity) {
+		u32 capacity = index->capacity ? index->capacity * 2 : 4096;
+		// objects holds the collected offsets in its second half, and the sorted ones in the first
+		dword *objects = (dword *)malloc(2 * (size_t)capacity * sizeof(dword));
+		u16 *scratch = (u16 *)realloc(index->scratch, capacity * sizeof(u16));
+		if (objects == NULL || scratch == NULL) { free(objects); if (scratch) index->scratch = scratch; return FALSE; }
+		if (index->objects) memcpy(objects + capacity, index->objects + index->capacity, index->nobjects * sizeof(dword));
+		free(index->objects);
+		index->objects = objects;
+		index->scratch = scratch;
+		index->capacity = capacity;
+	}
+	index->objects[index->capacity + index->nobjects] = entry->ptr;
+	index->scratch[index->nobjects++] = bucket - 1;
+	return TRUE;
+}
+
+void ocad_paint_data_fill(OCADPaintData *pdata, const OCADRect *rect) {
+	OCADPaintColorIndex *index = &pdata->index;
+	u32 *start = index->object_start;
+	u32 i, b, sum;
+	bool ok;
+
+	index->nobjects = 0;
+	if (start == NULL) return; // not initialized
+	memset(start, 0, (index->nsyms + 2) * sizeof(u32));
+	pdata->rect_set = (rect != NULL);
+	if (rect != NULL) {
+		pdata->rect = *rect;
+		ok = ocad_spatial_iterate(pdata->file, rect, ocad_paint_data_collect_cb, pdata);
+	}
+	else {
+		ok = ocad_object_entry_iterate(pdata->file, ocad_paint_data_collect_cb, pdata);
+	}
+	if (!ok) { index->nobjects = 0; return; }
+
+	// Counting sort by bucket; the order within a bucket stays the order of collection
+	for (i = 0; i < index->nobjects; i++) start[index->scratch[i] + 2]++;
+	sum = 0;
+	for (b = 0; b <= index->nsyms; b++) { sum += start[b + 1]; start[b + 1] = sum; }
+	for (i = 0; i < index->nobjects; i++) {
+		index->objects[start[index->scratch[i] + 1]++] = index->objects[index->capacity + i];
+	}
+}
+
+bool ocad_paint(const OCADPaintData *pdata, OCADPaintCallback *callback, void *param) {
+	const OCADPaintColorIndex *index = &pdata->index;
+	OCADFile *pfile = pdata->file;
+	int c;
+	if (index->object_start == NULL || index->nobjects == 0) return TRUE;
+	for (c = 255; c >= 0; c--) {
+		bool color_set = FALSE;
+		u32 k;
+		for (k = index->color_start[c]; k < index->color_start[c + 1]; k++) {
+			u32 b = index->color_buckets[k];
+			u32 i, first = index->object_start[b], last = index->object_start[b + 1];
+			s16 number = index->symbols[b];
+			OCADSymbol *symbol;
+			if (first == last) continue;
+			if (!color_set) {
+				if (callback->set_color) callback->set_color(param, pfile, pfile->colors + c);
+				color_set = TRUE;
+			}
+			symbol = ocad_symbol(pfile, number);
+			if (callback->set_symbol) callback->set_symbol(param, pfile, number, symbol);
+			for (i = first; i < last; i++) {
+				OCADObject *object = (OCADObject *)ocad_file_ptr(pfile, index->objects[i]);
+				if (!callback->paint_object(param, pfile, number, symbol, object)) return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
@@ -18,163 +18,114 @@
  */
 
 #include <math.h>
+#include <stdlib.h>
 #include "libocad.h"
 #include "geometry.h"
 
-// Internal path structure
+// SIMD support for ocad_path_from_world(): SSE2 is part of every x86-64 processor, AVX is
+// checked at runtime.
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCAD_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#define OCAD_AVX
+#define OCAD_TARGET_AVX
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define OCAD_AVX
+#define OCAD_TARGET_AVX __attribute__((target("avx")))
+#include <immintrin.h>
+#endif
+#endif
 
-#define MAX_PATH_POINTS 32768
-#define F_PATH_CONTROL 1
-#define F_PATH_CORNER 2
-#define F_PATH_DASH 4
-#define F_PATH_MOVE 8
-#define F_PATH_NO_STROKE 16
+// Transformed coordinates must be strictly inside this bound to round into 24 bits
+#define WORLD_COORD_LIMIT 8388607.5
 
-typedef
-struct _IntPath {
-	u32 count;
-	s32 x[MAX_PATH_POINTS];
-	s32 y[MAX_PATH_POINTS];
-	u8 f[MAX_PATH_POINTS];
-}
-IntPath;
-
-/** Reverses a section of a u8 array. The caller is reponsible for sending a valid range.
+/** Returns the index of the first point from start on whose y carries the PY_HOLE flag, or npts
+ *  if there is none.
  */
-static void reverse_u8(u8 *arr, u32 start, u32 count) {
-	u32 i = start, j = start + count - 1;
-	while (i < j) {
-		u8 s = arr[i];
-		arr[i] = arr[j];
-		arr[j] = s;
-		i++; j--;
+static u32 ocad_path_next_hole(const OCADPoint *pts, u32 start, u32 npts) {
+	u32 i = start;
+#ifdef OCAD_SSE2
+	// Test the flags of two points at a time
+	__m128i mask = _mm_set_epi32(PY_HOLE, 0, PY_HOLE, 0);
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 2 <= npts; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(pts + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, mask), zero)) != 0xFFFF) break;
 	}
-}
-
-
-/** Reverses a section of an s32 array. The caller is reponsible for sending a valid range.
- */
-static void reverse_s32(s32 *arr, u32 start, u32 count) {
-	u32 i = start, j = start + count - 1;
-	while (i < j) {
-		s32 s = arr[i];
-		arr[i] = arr[j];
-		arr[j] = s;
-		i++; j--;
+#endif
+	for (; i < npts; i++) {
+		if (pts[i].y & PY_HOLE) return i;
 	}
+	return npts;
 }
 
-/** Returns the signed area of a subsection of an IntPath, in map units.
+/** Returns the orientation of a ring of points, either 1 or -1, or 0 if it has no area.
  */
-static s64 ocad_internal_path_area(IntPath *path, u32 start, u32 count) {
+static s8 ocad_path_ring_sign(const OCADPoint *pts, u32 count) {
 	s64 a = 0LL;
-	u32 last = start + count - 1;
-	s32 lx = path->x[start + count - 1], ly = path->y[last];
-	int i;
+	s32 lx = pts[count - 1].x >> 8, ly = pts[count - 1].y >> 8;
+	u32 i;
 	for (i = 0; i < count; i++) {
-		s32 x = path->x[start + i], y = path->y[start + i];
-		a = a + lx * y - ly * x;
+		s32 x = pts[i].x >> 8, y = pts[i].y >> 8;
+		a += (s64)lx * y - (s64)ly * x;
 		lx = x; ly = y;
 	}
-	return a;
+	return (a < 0) ? -1 : (a > 0);
 }
 
-/** Returns the orientation of a subsection of an IntPath, either 1 or -1.
- *  If the path is empty, 0 is returned.
+/** Calls the callback for the segments of a ring, which is walked backwards if step is -1. The
+ *  ring starts with a MoveTo, which has to be on a point that isn't a control point.
  */
-static s8 ocad_internal_path_area_sign(IntPath *path, u32 start, u32 count) {
-	s64 area = ocad_internal_path_area(path, start, count);
-	if (area < 0) return -1;
-	if (area > 0) return 1;
-	return 0;
-}
-
-/** Reverses a section of an IntPath
- */
-static void ocad_internal_path_reverse(IntPath *path, u32 start, u32 count) {
-	reverse_s32(path->x, start, count);
-	reverse_s32(path->y, start, count);
-	reverse_u8(path->f, start, count);
-}
-
-
-/** Converts a contiguous set of OCADPoints to an IntPath. The point values are copied, flags are
- *  adjusted, and any sections marked as holes are given the correct orientation. The result is
- *  a path that is suitable for use in PostScript or PDF. (The even-odd winding rule should be assumed)
- *
- */
-static int ocad_path_to_internal(IntPath *path, u32 npts, const OCADPoint *pts) {
-#define F_PATH_HOLE 0x80 // not publically accessible, temporary and will be removed before the method returns
+static bool ocad_path_iterate_ring(const OCADPoint *pts, u32 count, int step, IntPathCallback callback, void *param) {
+	s32 pt[6];
+	int n = 0;
+	bool first = TRUE;
+	const OCADPoint *p = (step > 0) ? pts : pts + count - 1;
 	u32 i;
-	u32 hole_idx;
-	u32 j;
-	s8 sign;
-	path->count = npts;
-	for (i = 0; i < npts; i++) {
-		u8 f;
-		s32 x = pts[i].x, y = pts[i].y;
-		path->x[i] = (x >> 8);
-		path->y[i] = (y >> 8);
-		f = 0;
-		if (x & (PX_CTL1 | PX_CTL2)) f |= F_PATH_CONTROL;
-        if (y & PY_CORNER) f |= F_PATH_CORNER;
-		if (y & PY_DASH) f |= F_PATH_DASH;
-		if (y & PY_HOLE) f |= F_PATH_HOLE;
-		// F_PATH_NO_STROKE isn't used except for left and right paths on a line object
-		path->f[i] = f;
-	}
-	// Check for holes. If we encounter a section of the path with the hole flag,
-	// we need to see if its orientation matches the main segment. If it's the
-	// same, then E/O would fail to make it a hole.
-	hole_idx = 0;
-	sign = 0;
-	for (j = 0; j < npts; j++) {
-		if (path->f[j] & F_PATH_HOLE) {
-			path->f[j] &= ~F_PATH_HOLE;
-			if (hole_idx == 0) {
-				// This is the main part of the path; find its area
-				sign = ocad_internal_path_area_sign(path, 0, j);
-			}
-			else {
-				// We've reached the end of a hole segment
-				s8 hole_sign = ocad_internal_path_area_sign(path, hole_idx, j - hole_idx);
-				if (sign == hole_sign) ocad_internal_path_reverse(path, hole_idx, j - hole_idx);
-			}
-			hole_idx = j;
-			path->f[j] |= F_PATH_MOVE;
+	for (i = 0; i < count; i++, p += step) {
+		pt[n++] = p->x >> 8;
+		pt[n++] = p->y >> 8;
+		if (p->x & (PX_CTL1 | PX_CTL2)) {
+			if (n == 6) return FALSE; // more than two control points in a row
+			continue;
 		}
-	}
-	return 0;
-}
-
-/** Iterates over an IntPath. For each point in the given path, the callback is called and passed 
- *  the user_object, the segment type, and the segment endpoint.
- */
-static bool ocad_internal_path_iterate(IntPath *path, IntPathCallback callback, void *user_object) {
-	s32 pt[6]; int n = 0; bool first = TRUE; u32 i;
-	for (i = 0; i < path->count; i++) {
-		pt[n++] = path->x[i];
-		pt[n++] = path->y[i];
-		if (path->f[i] & F_PATH_CONTROL) continue;
 		if (n == 2) {
-			if (first) callback(user_object, MoveTo, pt); 
-			else callback(user_object, SegmentLineTo, pt);
+			if (!callback(param, first ? MoveTo : SegmentLineTo, pt)) return FALSE;
 		}
 		else if (n == 6) {
-			if (first) return FALSE; else callback(user_object, CurveTo, pt);
+			if (first || !callback(param, CurveTo, pt)) return FALSE;
 		}
-		first = FALSE; n = 0;
+		// a single control point in front of an anchor is skipped with the anchor
+		first = FALSE;
+		n = 0;
 	}
 	return TRUE;
 }
 
-/** Iterates over an OCADPath by first converting it to an IntPath, and then calling 
- *  ocad_internal_path_iterate.
+/** Iterates over the points directly: the first ring is the outline, and every point flagged with
+ *  PY_HOLE starts a hole. Holes turned like the outline are walked backwards, so they stay holes
+ *  with the nonzero winding rule as well as with even-odd.
  */
 bool ocad_path_iterate(u32 npts, const OCADPoint *pts, IntPathCallback callback, void *param) {
-	IntPath path;
-	ocad_path_to_internal(&path, npts, pts);
-	return ocad_internal_path_iterate(&path, callback, param);
+	u32 start = 0, end;
+	s8 sign = 0;
+	while (start < npts) {
+		int step = 1;
+		end = ocad_path_next_hole(pts, start + 1, npts);
+		if (start == 0) {
+			// The orientation of the outline only matters if there are holes
+			if (end < npts) sign = ocad_path_ring_sign(pts, end);
+		}
+		else if (sign != 0 && ocad_path_ring_sign(pts + start, end - start) == sign) {
+			step = -1;
+		}
+		if (!ocad_path_iterate_ring(pts + start, end - start, step, callback, param)) return FALSE;
+		start = end;
+	}
+	return TRUE;
 }
 
 /** Returns the signed area of a subsection of path, in map units.
@@ -215,6 +166,246 @@ void ocad_path_map(const Transform *matrix, const OCADPoint *pts, OCADPoint *opt
 	}
 }
 
+/** Portable part of ocad_path_from_world(), which also handles the points left over by the
+ *  vectorized versions.
+ */
+static bool ocad_path_from_world_scalar(const Transform *m, const double *x, const double *y, OCADPoint *opts, u32 npts) {
+	bool ok = TRUE;
+	u32 i;
+	for (i = 0; i < npts; i++) {
+		double px = m->m00 * x[i] + m->m01 * y[i] + m->m02;
+		double py = m->m10 * x[i] + m->m11 * y[i] + m->m12;
+		if (!(px > -WORLD_COORD_LIMIT && px < WORLD_COORD_LIMIT && py > -WORLD_COORD_LIMIT && py < WORLD_COORD_LIMIT)) {
+			ok = FALSE;
+			continue;
+		}
+		opts[i].x = (s32)(px + (px < 0 ? -0.5 : 0.5)) << 8;
+		opts[i].y = (s32)(py + (py < 0 ? -0.5 : 0.5)) << 8;
+	}
+	return ok;
+}
+
+#ifdef OCAD_SSE2
+/** ocad_path_from_world() for two points at a time.
+ */
+static bool ocad_path_from_world_sse2(const Transform *m, const double *x, const double *y, OCADPoint *opts, u32 npts) {
+	__m128d m00 = _mm_set1_pd(m->m00), m01 = _mm_set1_pd(m->m01), m02 = _mm_set1_pd(m->m02);
+	__m128d m10 = _mm_set1_pd(m->m10), m11 = _mm_set1_pd(m->m11), m12 = _mm_set1_pd(m->m12);
+	__m128d lim = _mm_set1_pd(WORLD_COORD_LIMIT), nlim = _mm_set1_pd(-WORLD_COORD_LIMIT);
+	__m128d half = _mm_set1_pd(0.5), sign = _mm_set1_pd(-0.0);
+	__m128d ok = _mm_cmpeq_pd(half, half);
+	u32 i;
+	for (i = 0; i + 2 <= npts; i += 2) {
+		__m128d vx = _mm_loadu_pd(x + i), vy = _mm_loadu_pd(y + i);
+		__m128d px = _mm_add_pd(_mm_add_pd(_mm_mul_pd(m00, vx), _mm_mul_pd(m01, vy)), m02);
+		__m128d py = _mm_add_pd(_mm_add_pd(_mm_mul_pd(m10, vx), _mm_mul_pd(m11, vy)), m12);
+		__m128i ix, iy;
+		ok = _mm_and_pd(ok, _mm_and_pd(_mm_cmplt_pd(px, lim), _mm_cmpgt_pd(px, nlim)));
+		ok = _mm_and_pd(ok, _mm_and_pd(_mm_cmplt_pd(py, lim), _mm_cmpgt_pd(py, nlim)));
+		// round halves away from zero: add 0.5 with the sign of the value, then truncate
+		ix = _mm_cvttpd_epi32(_mm_add_pd(px, _mm_or_pd(half, _mm_and_pd(px, sign))));
+		iy = _mm_cvttpd_epi32(_mm_add_pd(py, _mm_or_pd(half, _mm_and_pd(py, sign))));
+		_mm_storeu_si128((__m128i *)(opts + i), _mm_slli_epi32(_mm_unpacklo_epi32(ix, iy), 8));
+	}
+	if (_mm_movemask_pd(ok) != 0x3) return FALSE;
+	return ocad_path_from_world_scalar(m, x + i, y + i, opts + i, npts - i);
+}
+#endif
+
+#ifdef OCAD_AVX
+/** Returns TRUE if the processor and the operating system support AVX.
+ */
+static bool ocad_cpu_has_avx(void) {
+	static int has_avx = -1;
+	if (has_avx < 0) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		// AVX and OSXSAVE, and the OS saves the SSE and AVX registers
+		has_avx = ((info[2] & 0x18000000) == 0x18000000) && ((_xgetbv(0) & 0x6) == 0x6);
+#else
+		__builtin_cpu_init();
+		has_avx = __builtin_cpu_supports("avx") ? 1 : 0;
+#endif
+	}
+	return has_avx != 0;
+}
+
+/** ocad_path_from_world() for four points at a time.
+ */
+OCAD_TARGET_AVX
+static bool ocad_path_from_world_avx(const Transform *m, const double *x, const double *y, OCADPoint *opts, u32 npts) {
+	__m256d m00 = _mm256_set1_pd(m->m00), m01 = _mm256_set1_pd(m->m01), m02 = _mm256_set1_pd(m->m02);
+	__m256d m10 = _mm256_set1_pd(m->m10), m11 = _mm256_set1_pd(m->m11), m12 = _mm256_set1_pd(m->m12);
+	__m256d lim = _mm256_set1_pd(WORLD_COORD_LIMIT), nlim = _mm256_set1_pd(-WORLD_COORD_LIMIT);
+	__m256d half = _mm256_set1_pd(0.5), sign = _mm256_set1_pd(-0.0);
+	__m256d ok = _mm256_cmp_pd(half, half, _CMP_EQ_OQ);
+	bool all_ok;
+	u32 i;
+	for (i = 0; i + 4 <= npts; i += 4) {
+		__m256d vx = _mm256_loadu_pd(x + i), vy = _mm256_loadu_pd(y + i);
+		__m256d px = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m00, vx), _mm256_mul_pd(m01, vy)), m02);
+		__m256d py = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m10, vx), _mm256_mul_pd(m11, vy)), m12);
+		__m128i ix, iy;
+		ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(px, lim, _CMP_LT_OQ), _mm256_cmp_pd(px, nlim, _CMP_GT_OQ)));
+		ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(py, lim, _CMP_LT_OQ), _mm256_cmp_pd(py, nlim, _CMP_GT_OQ)));
+		ix = _mm256_cvttpd_epi32(_mm256_add_pd(px, _mm256_or_pd(half, _mm256_and_pd(px, sign))));
+		iy = _mm256_cvttpd_epi32(_mm256_add_pd(py, _mm256_or_pd(half, _mm256_and_pd(py, sign))));
+		_mm_storeu_si128((__m128i *)(opts + i), _mm_slli_epi32(_mm_unpacklo_epi32(ix, iy), 8));
+		_mm_storeu_si128((__m128i *)(opts + i + 2), _mm_slli_epi32(_mm_unpackhi_epi32(ix, iy), 8));
+	}
+	all_ok = (_mm256_movemask_pd(ok) == 0xf);
+	_mm256_zeroupper();
+	if (!all_ok) return FALSE;
+	return ocad_path_from_world_scalar(m, x + i, y + i, opts + i, npts - i);
+}
+#endif
+
+bool ocad_path_from_world(const Transform *matrix, const double *x, const double *y, OCADPoint *opts, u32 npts) {
+#ifdef OCAD_AVX
+	if (ocad_cpu_has_avx()) return ocad_path_from_world_avx(matrix, x, y, opts, npts);
+#endif
+#ifdef OCAD_SSE2
+	return ocad_path_from_world_sse2(matrix, x, y, opts, npts);
+#else
+	return ocad_path_from_world_scalar(matrix, x, y, opts, npts);
+#endif
+}
+
+/** Returns TRUE if the point pt must survive simplification, given its neighbours prev and next
+ *  (NULL at the ends of the path): the end points, points with flags, and the neighbours of curve
+ *  control points, which are the ends of the curve.
+ */
+static bool ocad_path_is_anchor(const OCADPoint *prev, const OCADPoint *pt, const OCADPoint *next) {
+	if (prev == NULL || next == NULL) return TRUE;
+	if ((pt->x & 0xff) || (pt->y & 0xff)) return TRUE;
+	if ((prev->x | next->x) & (PX_CTL1 | PX_CTL2)) return TRUE;
+	return FALSE;
+}
+
+/** Douglas-Peucker between the anchors a and b: marks the points in between which are farther
+ *  than tol from the simplified line. The stack needs room for 2 * (b - a) entries.
+ */
+static void ocad_path_simplify_run(const OCADPoint *pts, u32 a, u32 b, double tol, u8 *keep, u32 *stack) {
+	u32 sp = 0;
+	stack[sp++] = a; stack[sp++] = b;
+	while (sp > 0) {
+		u32 e = stack[--sp], s = stack[--sp], i, imax = 0;
+		double x1 = pts[s].x >> 8, y1 = pts[s].y >> 8;
+		double dx = (double)(pts[e].x >> 8) - x1, dy = (double)(pts[e].y >> 8) - y1;
+		double len2 = dx * dx + dy * dy, dmax = 0;
+		for (i = s + 1; i < e; i++) {
+			double px = (pts[i].x >> 8) - x1, py = (pts[i].y >> 8) - y1, d;
+			// squared distance to the line, scaled by len2; to the start if the line is a point
+			if (len2 > 0) { d = px * dy - py * dx; d = d * d; }
+			else d = px * px + py * py;
+			if (d > dmax) { dmax = d; imax = i; }
+		}
+		if (imax != 0 && dmax > tol * tol * (len2 > 0 ? len2 : 1)) {
+			keep[imax] = 1;
+			stack[sp++] = s; stack[sp++] = imax;
+			stack[sp++] = imax; stack[sp++] = e;
+		}
+	}
+}
+
+u32 ocad_path_simplify(OCADPoint *pts, u32 npts, s32 tolerance) {
+	u8 keep_buf[256];
+	u32 stack_buf[512];
+	u8 *keep = keep_buf;
+	u32 *stack = stack_buf;
+	u32 i, n, a;
+	OCADPoint prev, cur;
+	if (npts < 2) return npts;
+	if (tolerance > 0 && npts > 256) {
+		keep = (u8 *)malloc(npts);
+		stack = (u32 *)malloc(2 * npts * sizeof(u32));
+		if (keep == NULL || stack == NULL) tolerance = 0; // still drop the duplicates
+	}
+
+	// Mark the points to keep: all of them without tolerance, else the anchors and what
+	// Douglas-Peucker needs between them
+	for (i = 0, a = 0; i < npts; i++) {
+		if (tolerance <= 0 || ocad_path_is_anchor(i > 0 ? &pts[i - 1] : NULL, &pts[i], i + 1 < npts ? &pts[i + 1] : NULL)) {
+			if (tolerance > 0) {
+				keep[i] = 1;
+				if (i > a + 1) ocad_path_simplify_run(pts, a, i, tolerance, keep, stack);
+				a = i;
+			}
+		}
+		else keep[i] = 0;
+	}
+
+	// Compact the kept points, dropping those which repeat the previous position. The output
+	// overwrites the input behind i, so the original of the previous point is kept in prev.
+	for (i = 0, n = 0; i < npts; i++) {
+		cur = pts[i];
+		if (tolerance > 0 && !keep[i]) { prev = cur; continue; }
+		if (n > 0 && ((cur.x ^ pts[n - 1].x) & ~0xff) == 0 && ((cur.y ^ pts[n - 1].y) & ~0xff) == 0) {
+			if (!ocad_path_is_anchor(&prev, &cur, i + 1 < npts ? &pts[i + 1] : NULL)) { prev = cur; continue; }
+			// A plain point in front of an anchor at the same position makes way for the anchor
+			if (n > 1 && (pts[n - 1].x & 0xff) == 0 && (pts[n - 1].y & 0xff) == 0
+					&& !(pts[n - 2].x & (PX_CTL1 | PX_CTL2)) && !(cur.x & (PX_CTL1 | PX_CTL2))) n--;
+		}
+		pts[n++] = cur;
+		prev = cur;
+	}
+
+	if (keep != keep_buf) free(keep);
+	if (stack != stack_buf) free(stack);
+	return n;
+}
+
+/** Sutherland-Hodgman for a single ring against the half plane where the coordinate selected by
+ *  axis (0 for x, 1 for y) is at most (below) or at least (!below) value. Appends the clipped
+ *  ring to opts without flags and returns the number of points written.
+ */
+static u32 ocad_path_clip_ring(const OCADPoint *pts, u32 npts, int axis, s32 value, bool below, OCADPoint *opts) {
+	u32 i, n = 0;
+	s32 px, py, pc;
+	bool pin;
+	if (npts == 0) return 0;
+	px = pts[npts - 1].x >> 8; py = pts[npts - 1].y >> 8;
+	pc = axis ? py : px;
+	pin = below ? (pc <= value) : (pc >= value);
+	for (i = 0; i < npts; i++) {
+		s32 x = pts[i].x >> 8, y = pts[i].y >> 8;
+		s32 c = axis ? y : x;
+		bool in = below ? (c <= value) : (c >= value);
+		if (in != pin) {
+			// The edge crosses the cut line; the crossing lies exactly on it
+			double t = (double)(value - pc) / (double)(c - pc);
+			s32 o = axis ? (s32)floor(px + t * (x - px) + 0.5) : (s32)floor(py + t * (y - py) + 0.5);
+			opts[n].x = (axis ? o : value) << 8;
+			opts[n].y = (axis ? value : o) << 8;
+			n++;
+		}
+		if (in) {
+			opts[n].x = x << 8;
+			opts[n].y = y << 8;
+			n++;
+		}
+		px = x; py = y; pc = c; pin = in;
+	}
+	return n;
+}
+
+u32 ocad_path_clip(const OCADPoint *pts, u32 npts, int axis, s32 value, bool below, OCADPoint *opts) {
+	u32 start = 0, n = 0;
+	while (start < npts) {
+		u32 end = start + 1, got;
+		while (end < npts && !(pts[end].y & PY_HOLE)) end++;
+		got = ocad_path_clip_ring(pts + start, end - start, axis, value, below, opts + n);
+		if (start == 0 && got < 3) return 0; // nothing left of the outline, so neither of the holes
+		if (got >= 3) {
+			if (start > 0) opts[n].y |= PY_HOLE;
+			n += got;
+		}
+		start = end;
+	}
+	return n;
+}
+
 /** Applies the inverse of a matrix transformation to a collection of contiguous OCADPoints. This is done
  *  by inverting the matrix and then calling ocad_path_map. Returns TRUE if the call was successful, or
  *  FALSE if the supplied matrix was not invertible.
@@ -302,10 +493,10 @@ void ocad_rect_union(OCADRect *r1, const OCADRect *r2) {
 	if (y3 < y1) y1 = y3;
 	if (x4 > x2) x2 = x4;
 	if (y4 > y2) y2 = y4;
-	r1->min.x = (r1->min.x & 0xff) | (x1 << 8);
-	r1->max.y = (r1->min.y & 0xff) | (y1 << 8);
-	r1->min.x = (r1->max.x & 0xff) | (x2 << 8);
-	r1->max.y = (r1->max.y & 0xff) | (y2 << 8);
+	r1->min.x = (r1->min.x & 0xff) | x1;
+	r1->min.y = (r1->min.y & 0xff) | y1;
+	r1->max.x = (r1->max.x & 0xff) | x2;
+	r1->max.y = (r1->max.y & 0xff) | y2;
 }
 
 
@@ -17,8 +17,13 @@
  *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
 #include "libocad.h"
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 bool ocad_setup_world_matrix(OCADFile *pfile, Transform *matrix) {
 	OCADSetup *setup;
 	double s;
@@ -42,3 +47,21 @@ bool ocad_setup_paper_matrix(OCADFile *pfile, Transform *matrix) {
 	matrix_scale(matrix, s, s);
 	return TRUE;
 }
+
+bool ocad_setup_map_matrix(OCADFile *pfile, Transform *matrix) {
+	OCADSetup *setup;
+	double s, a, c, sn;
+	if (!pfile || !pfile->setup) return FALSE;
+	setup = pfile->setup;
+	if (setup->scale <= 0) return FALSE;
+	s = 100000.0 / setup->scale; // meters in the terrain to 0.01 mm on the map
+	a = M_PI * setup->angle / 180.0;
+	c = cos(a) * s;
+	sn = sin(a) * s;
+	// map = R(-angle) * (world - offset) * s
+	matrix->m00 = c; matrix->m01 = sn;
+	matrix->m10 = -sn; matrix->m11 = c;
+	matrix->m02 = -(c * setup->offsetx + sn * setup->offsety);
+	matrix->m12 = -(-sn * setup->offsetx + c * setup->offsety);
+	return TRUE;
+}
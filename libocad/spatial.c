@@ -0,0 +1,385 @@
+/*
+ *    Copyright 2012 Peter Curtis
+ *
+ *    This file is part of libocad.
+ *
+ *    libocad is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libocad is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libocad.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libocad.h"
+
+/* The spatial index is a packed Hilbert R-tree: the entries are sorted along a Hilbert curve
+ * through the centers of their rectangles and grouped into nodes of OCAD_SPATIAL_NODE_SIZE, and
+ * the nodes are grouped the same way until a single root is left. All levels are stored in one
+ * array, starting with the leaves and ending with the root.
+ */
+
+#define OCAD_SPATIAL_NODE_SIZE 16
+#define OCAD_SPATIAL_MAX_LEVELS 16
+
+struct _OCADSpatialIndex {
+	u32 nitems;			// Number of leaves, which refer to object index entries
+	u32 nnodes;			// Number of boxes on all levels
+	u32 nlevels;		// Number of levels including the leaves
+	u32 level_end[OCAD_SPATIAL_MAX_LEVELS]; // Index behind the last box of each level
+	s32 *boxes;			// Four coordinates per box: min x, min y, max x, max y in map units
+	u32 *refs;			// Leaves: offset of the index entry; nodes: index of the first child
+};
+
+/** Returns the distance of a point along a Hilbert curve through a 65536 x 65536 grid.
+ */
+static u32 ocad_spatial_hilbert(u32 x, u32 y) {
+	u32 a, b, c, d, A, B, C, D, i0, i1;
+	a = x ^ y;
+	b = 0xFFFF ^ a;
+	c = 0xFFFF ^ (x | y);
+	d = x & (y ^ 0xFFFF);
+
+	A = a | (b >> 1);
+	B = (a >> 1) ^ a;
+	C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+	D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+	a = A; b = B; c = C; d = D;
+	A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+	B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+	C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+	D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+	a = A; b = B; c = C; d = D;
+	A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+	B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+	C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+	D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+	a = A; b = B; c = C; d = D;
+	C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+	D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+	a = C ^ (C >> 1);
+	b = D ^ (D >> 1);
+
+	i0 = x ^ y;
+	i1 = b | (0xFFFF ^ (i0 | a));
+
+	i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+	i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+	i0 = (i0 | (i0 << 2)) & 0x33333333;
+	i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+	i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+	i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+	i1 = (i1 | (i1 << 2)) & 0x33333333;
+	i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+	return (i1 << 1) | i0;
+}
+
+/** Sorts the items by their keys with a byte-wise radix sort, using tmp as scratch space for
+ *  count keys and items. The sort is stable.
+ */
+static void ocad_spatial_sort(u32 *keys, u32 *items, u32 *tmp_keys, u32 *tmp_items, u32 count) {
+	u32 shift, i;
+	for (shift = 0; shift < 32; shift += 8) {
+		u32 start[256];
+		u32 sum = 0;
+		memset(start, 0, sizeof(start));
+		for (i = 0; i < count; i++) start[(keys[i] >> shift) & 0xFF]++;
+		for (i = 0; i < 256; i++) { u32 n = start[i]; start[i] = sum; sum += n; }
+		for (i = 0; i < count; i++) {
+			u32 k = start[(keys[i] >> shift) & 0xFF]++;
+			tmp_keys[k] = keys[i];
+			tmp_items[k] = items[i];
+		}
+		memcpy(keys, tmp_keys, count * sizeof(u32));
+		memcpy(items, tmp_items, count * sizeof(u32));
+	}
+}
+
+/** Collects the index entries of all objects. Returns the number of entries, and stores them in
+ *  a new array at *poffsets, or returns -1 if memory is exhausted.
+ */
+static s32 ocad_spatial_collect(OCADFile *pfile, u32 **poffsets) {
+	OCADObjectIndex *idx;
+	u32 count = 0, capacity = 0;
+	u32 *offsets = NULL;
+	for (idx = ocad_objidx_first(pfile); idx != NULL; idx = ocad_objidx_next(pfile, idx)) {
+		int i;
+		if (count + 256 > capacity) {
+			u32 *grown;
+			capacity = capacity ? capacity * 2 : 4096;
+			grown = (u32 *)realloc(offsets, capacity * sizeof(u32));
+			if (grown == NULL) { free(offsets); return -1; }
+			offsets = grown;
+		}
+		for (i = 0; i < 256; i++) {
+			OCADObjectEntry *entry = &idx->entry[i];
+			if (entry->ptr && entry->symbol) offsets[count++] = ocad_file_offset(pfile, entry);
+		}
+	}
+	*poffsets = offsets;
+	return count;
+}
+
+void ocad_spatial_free(OCADSpatialIndex *index) {
+	if (index == NULL) return;
+	free(index->boxes);
+	free(index->refs);
+	free(index);
+}
+
+void ocad_spatial_invalidate(OCADFile *pfile) {
+	if (pfile->spatial == NULL) return;
+	ocad_spatial_free(pfile->spatial);
+	pfile->spatial = NULL;
+}
+
+OCADSpatialIndex *ocad_spatial_build(OCADFile *pfile) {
+	OCADSpatialIndex *index;
+	u32 *offsets = NULL, *keys = NULL, *tmp = NULL;
+	s32 minx = 0x7FFFFFFF, miny = 0x7FFFFFFF, maxx = -0x7FFFFFFF - 1, maxy = -0x7FFFFFFF - 1;
+	double sx, sy;
+	s32 n;
+	u32 i, total, level, start, end;
+
+	if (pfile->spatial != NULL) return pfile->spatial;
+	if (!pfile->header) return NULL;
+
+	n = ocad_spatial_collect(pfile, &offsets);
+	if (n < 0) return NULL;
+
+	// Size the levels, each one has a box per OCAD_SPATIAL_NODE_SIZE boxes of the level below
+	index = (OCADSpatialIndex *)calloc(1, sizeof(OCADSpatialIndex));
+	if (index == NULL) { free(offsets); return NULL; }
+	index->nitems = n;
+	total = n;
+	index->level_end[0] = n;
+	index->nlevels = 1;
+	for (i = n; i > 1; ) {
+		i = (i + OCAD_SPATIAL_NODE_SIZE - 1) / OCAD_SPATIAL_NODE_SIZE;
+		total += i;
+		index->level_end[index->nlevels++] = total;
+	}
+	index->nnodes = total;
+	index->boxes = (s32 *)malloc(((size_t)total * 4 + 4) * sizeof(s32));
+	index->refs = (u32 *)malloc(((size_t)total + 1) * sizeof(u32));
+	keys = (u32 *)malloc(((size_t)n * 3 + 1) * sizeof(u32));
+	if (index->boxes == NULL || index->refs == NULL || keys == NULL) goto ocad_spatial_build_1;
+	tmp = keys + n;
+
+	// Order the entries along a Hilbert curve through the centers of their rectangles
+	for (i = 0; i < (u32)n; i++) {
+		OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, offsets[i]);
+		s32 cx = ((entry->rect.min.x >> 8) >> 1) + ((entry->rect.max.x >> 8) >> 1);
+		s32 cy = ((entry->rect.min.y >> 8) >> 1) + ((entry->rect.max.y >> 8) >> 1);
+		if (cx < minx) minx = cx;
+		if (cx > maxx) maxx = cx;
+		if (cy < miny) miny = cy;
+		if (cy > maxy) maxy = cy;
+	}
+	sx = (maxx > minx) ? 65535.0 / ((double)maxx - minx) : 0;
+	sy = (maxy > miny) ? 65535.0 / ((double)maxy - miny) : 0;
+	for (i = 0; i < (u32)n; i++) {
+		OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, offsets[i]);
+		s32 cx = ((entry->rect.min.x >> 8) >> 1) + ((entry->rect.max.x >> 8) >> 1);
+		s32 cy = ((entry->rect.min.y >> 8) >> 1) + ((entry->rect.max.y >> 8) >> 1);
+		keys[i] = ocad_spatial_hilbert((u32)(((double)cx - minx) * sx), (u32)(((double)cy - miny) * sy));
+	}
+	ocad_spatial_sort(keys, offsets, tmp, tmp + n, n);
+
+	// The leaves
+	for (i = 0; i < (u32)n; i++) {
+		OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, offsets[i]);
+		s32 *box = index->boxes + 4 * i;
+		box[0] = entry->rect.min.x >> 8;
+		box[1] = entry->rect.min.y >> 8;
+		box[2] = entry->rect.max.x >> 8;
+		box[3] = entry->rect.max.y >> 8;
+		index->refs[i] = offsets[i];
+	}
+
+	// The nodes, level by level
+	start = 0;
+	for (level = 1; level < index->nlevels; level++) {
+		u32 pos = index->level_end[level - 1];
+		end = index->level_end[level - 1];
+		for (i = start; i < end; i += OCAD_SPATIAL_NODE_SIZE, pos++) {
+			u32 j, last = (i + OCAD_SPATIAL_NODE_SIZE < end) ? i + OCAD_SPATIAL_NODE_SIZE : end;
+			s32 *box = index->boxes + 4 * pos;
+			memcpy(box, index->boxes + 4 * i, 4 * sizeof(s32));
+			for (j = i + 1; j < last; j++) {
+				const s32 *child = index->boxes + 4 * j;
+				if (child[0] < box[0]) box[0] = child[0];
+				if (child[1] < box[1]) box[1] = child[1];
+				if (child[2] > box[2]) box[2] = child[2];
+				if (child[3] > box[3]) box[3] = child[3];
+			}
+			index->refs[pos] = i;
+		}
+		start = end;
+	}
+
+	free(keys);
+	free(offsets);
+	pfile->spatial = index;
+	return index;
+
+ocad_spatial_build_1:
+	free(keys);
+	free(offsets);
+	ocad_spatial_free(index);
+	return NULL;
+}
+
+bool ocad_spatial_bounds(OCADFile *pfile, OCADRect *rect) {
+	OCADSpatialIndex *index = ocad_spatial_build(pfile);
+	const s32 *box;
+	if (index == NULL || index->nitems == 0) return FALSE;
+	box = index->boxes + 4 * (index->nnodes - 1);
+	rect->min.x = box[0] << 8;
+	rect->min.y = box[1] << 8;
+	rect->max.x = box[2] << 8;
+	rect->max.y = box[3] << 8;
+	return TRUE;
+}
+
+bool ocad_spatial_iterate(OCADFile *pfile, const OCADRect *rect, OCADObjectEntryCallback callback, void *param) {
+	OCADSpatialIndex *index = ocad_spatial_build(pfile);
+	u32 stack[OCAD_SPATIAL_NODE_SIZE * OCAD_SPATIAL_MAX_LEVELS];
+	u8 levels[OCAD_SPATIAL_NODE_SIZE * OCAD_SPATIAL_MAX_LEVELS];
+	u32 top = 0;
+	s32 x1, y1, x2, y2;
+	if (index == NULL) return FALSE;
+	if (index->nitems == 0) return TRUE;
+	x1 = rect->min.x >> 8; y1 = rect->min.y >> 8;
+	x2 = rect->max.x >> 8; y2 = rect->max.y >> 8;
+
+	// The root has no parent to check its box, which matters when it is the only entry
+	stack[top] = index->nnodes - 1;
+	levels[top] = (u8)(index->nlevels - 1);
+	{
+		const s32 *box = index->boxes + 4 * stack[top];
+		if (box[2] < x1 || box[0] > x2 || box[3] < y1 || box[1] > y2) return TRUE;
+	}
+	top++;
+	while (top > 0) {
+		u32 node = stack[--top];
+		u8 level = levels[top];
+		u32 i, first, last;
+		if (level == 0) {
+			OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, index->refs[node]);
+			if (entry->ptr && entry->symbol && !callback(param, pfile, entry)) return FALSE;
+			continue;
+		}
+		first = index->refs[node];
+		last = first + OCAD_SPATIAL_NODE_SIZE;
+		if (last > index->level_end[level - 1]) last = index->level_end[level - 1];
+		// Push the children in reverse, so they are visited in Hilbert order
+		for (i = last; i-- > first; ) {
+			const s32 *box = index->boxes + 4 * i;
+			if (box[2] < x1 || box[0] > x2 || box[3] < y1 || box[1] > y2) continue;
+			stack[top] = i;
+			levels[top++] = level - 1;
+		}
+	}
+	return TRUE;
+}
+
+typedef struct _SpatialQueueItem {
+	double dist;	// Squared distance from the query point to the box
+	u32 node;		// Index of the box
+	u32 level;		// Level of the box
+} SpatialQueueItem;
+
+/** Squared distance from the point to the box, 0 inside of the box.
+ */
+static double ocad_spatial_distance(const s32 *box, s32 x, s32 y) {
+	double dx = 0, dy = 0;
+	if (x < box[0]) dx = (double)box[0] - x;
+	else if (x > box[2]) dx = (double)x - box[2];
+	if (y < box[1]) dy = (double)box[1] - y;
+	else if (y > box[3]) dy = (double)y - box[3];
+	return dx * dx + dy * dy;
+}
+
+u32 ocad_spatial_nearest(OCADFile *pfile, const OCADPoint *pt, u32 k, OCADObjectEntry **entries, double *distances) {
+	OCADSpatialIndex *index = ocad_spatial_build(pfile);
+	SpatialQueueItem *heap;
+	u32 size = 0, capacity, found = 0;
+	s32 x, y;
+	if (index == NULL || index->nitems == 0 || k == 0) return 0;
+	x = pt->x >> 8;
+	y = pt->y >> 8;
+
+	// A binary min heap of boxes ordered by their distance; leaves which come out first are nearest
+	capacity = 64;
+	heap = (SpatialQueueItem *)malloc(capacity * sizeof(SpatialQueueItem));
+	if (heap == NULL) return 0;
+	heap[size].dist = 0;
+	heap[size].node = index->nnodes - 1;
+	heap[size++].level = index->nlevels - 1;
+	while (size > 0 && found < k) {
+		SpatialQueueItem item = heap[0];
+		u32 pos = 0;
+		// Take the top, and sift the last element down
+		size--;
+		while (2 * pos + 1 < size) {
+			u32 child = 2 * pos + 1;
+			if (child + 1 < size && heap[child + 1].dist < heap[child].dist) child++;
+			if (heap[child].dist >= heap[size].dist) break;
+			heap[pos] = heap[child];
+			pos = child;
+		}
+		heap[pos] = heap[size];
+
+		if (item.level == 0) {
+			OCADObjectEntry *entry = (OCADObjectEntry *)ocad_file_ptr(pfile, index->refs[item.node]);
+			if (entry->ptr && entry->symbol) {
+				entries[found] = entry;
+				if (distances) distances[found] = sqrt(item.dist);
+				found++;
+			}
+		}
+		else {
+			u32 i, first = index->refs[item.node];
+			u32 last = first + OCAD_SPATIAL_NODE_SIZE;
+			if (last > index->level_end[item.level - 1]) last = index->level_end[item.level - 1];
+			for (i = first; i < last; i++) {
+				SpatialQueueItem child;
+				if (size == capacity) {
+					SpatialQueueItem *grown = (SpatialQueueItem *)realloc(heap, 2 * capacity * sizeof(SpatialQueueItem));
+					if (grown == NULL) { free(heap); return found; }
+					heap = grown;
+					capacity *= 2;
+				}
+				child.dist = ocad_spatial_distance(index->boxes + 4 * i, x, y);
+				child.node = i;
+				child.level = item.level - 1;
+				// Sift up
+				pos = size++;
+				while (pos > 0 && heap[(pos - 1) / 2].dist > child.dist) {
+					heap[pos] = heap[(pos - 1) / 2];
+					pos = (pos - 1) / 2;
+				}
+				heap[pos] = child;
+			}
+		}
+	}
+	free(heap);
+	return found;
+}
@@ -61,7 +61,7 @@ OCADStringIndex *ocad_string_index_first(OCADFile *pfile) {
 	if (!pfile->header) return NULL;
 	offs = pfile->header->ostringidx;
 	if (offs == 0) return NULL;
-	return (OCADStringIndex *)(pfile->buffer + offs);
+	return (OCADStringIndex *)ocad_file_ptr(pfile, offs);
 }
 
 OCADStringIndex *ocad_string_index_next(OCADFile *pfile, OCADStringIndex *current) {
@@ -69,7 +69,7 @@ OCADStringIndex *ocad_string_index_next(OCADFile *pfile, OCADStringIndex *curren
 	if (!pfile->header || !current) return NULL;
 	offs = current->next;
 	if (offs == 0) return NULL;
-	return (OCADStringIndex *)(pfile->buffer + offs);
+	return (OCADStringIndex *)ocad_file_ptr(pfile, offs);
 }
 
 OCADStringEntry *ocad_string_entry_at(OCADFile *pfile, OCADStringIndex *current, int index) {
@@ -87,12 +87,17 @@ OCADStringEntry *ocad_string_entry_new(OCADFile *pfile, u32 size) {
 	if (!pfile->header) return NULL;
 	for (idx = ocad_string_index_first(pfile); idx != NULL; idx = ocad_string_index_next(pfile, idx)) {
 		int i;
-		last_idx_offset = (u8*)idx - pfile->buffer;
+		last_idx_offset = ocad_file_offset(pfile, idx);
 		for (i = 0; i < 256; i++) {
 			OCADStringEntry *entry = &(idx->entry[i]);
 			if (entry->type == 0) {
-				if (entry->size == 0 && empty_offset == 0) empty_offset = (u8*)&idx->entry[i] - pfile->buffer;
-				else if (entry->size >= size) return entry;
+				if (entry->size == 0 && empty_offset == 0) empty_offset = ocad_file_offset(pfile, &idx->entry[i]);
+				else if (entry->size >= size) {
+					// The caller fills in the entry and its old space
+					ocad_file_touch(pfile, entry, sizeof(OCADStringEntry));
+					ocad_file_touch(pfile, ocad_file_ptr(pfile, entry->ptr), entry->size);
+					return entry;
+				}
 			}
 		}
 	}
@@ -100,26 +105,29 @@ OCADStringEntry *ocad_string_entry_new(OCADFile *pfile, u32 size) {
 	if (empty_offset == 0) {
 		// We don't have any empty entries - need to create a new one!
 		if (last_idx_offset == 0) return NULL; // we don't support adding strings to files without string index block
-		ocad_file_reserve(pfile, sizeof(OCADStringIndex));
-		idx = (OCADStringIndex*)(pfile->buffer + last_idx_offset);
+		if (ocad_file_reserve(pfile, sizeof(OCADStringIndex)) == OCAD_OUT_OF_MEMORY) return NULL;
+		idx = (OCADStringIndex *)ocad_file_ptr(pfile, last_idx_offset);
 		idx->next = pfile->size;
-		idx = (OCADStringIndex*)(pfile->buffer + pfile->size);
+		ocad_file_touch(pfile, &idx->next, sizeof(idx->next));
+		idx = (OCADStringIndex *)ocad_file_ptr(pfile, pfile->size);
 		pfile->size += sizeof(OCADStringIndex);
-		empty_offset = (u8*)&idx->entry[0] - pfile->buffer;
+		empty_offset = ocad_file_offset(pfile, &idx->entry[0]);
 	}
 	
 	// There exists an empty index entry. We can allocate a new object and fill it
-	ocad_file_reserve(pfile, size);
-	empty = (OCADStringEntry*)(pfile->buffer + empty_offset);
+	if (ocad_file_reserve(pfile, size) == OCAD_OUT_OF_MEMORY) return NULL;
+	empty = (OCADStringEntry *)ocad_file_ptr(pfile, empty_offset);
 	empty->size = size;
 	empty->ptr = pfile->size;
 	pfile->size += empty->size;
+	ocad_file_touch(pfile, empty, sizeof(OCADStringEntry));
 	
 	return empty;
 }
 
 int ocad_string_remove(OCADFile *pfile, OCADStringEntry *entry) {
 	entry->type = 0;
+	ocad_file_touch(pfile, entry, sizeof(OCADStringEntry));
 	return 0;
 }
 
@@ -143,13 +151,13 @@ OCADCString *ocad_string_at(OCADFile *pfile, OCADStringIndex *current, int index
 	if (entry == NULL) return NULL;
 	offs = entry->ptr;
 	if (offs == 0) return NULL;
-	return (OCADCString *)(pfile->buffer + offs);
+	return (OCADCString *)ocad_file_ptr(pfile, offs);
 }
 
 OCADCString *ocad_string(OCADFile *pfile, OCADStringEntry *entry) {
 	if (!pfile->header) return NULL;
 	if (entry == NULL || entry->ptr == 0) return NULL;
-	return (OCADCString *)(pfile->buffer + entry->ptr);
+	return (OCADCString *)ocad_file_ptr(pfile, entry->ptr);
 }
 
 int ocad_string_add_background(OCADFile *pfile, OCADBackground *bg) {
@@ -15,6 +15,14 @@ class POINT(Structure):
 
 CreateOcadWriter=getattr(lib, "CreateOcadWriter") 
 CreateOcadWriter.restype=c_void_p
+CreateOcadWriterSized=getattr(lib, "CreateOcadWriterSized")
+CreateOcadWriterSized.argtypes=[c_double, c_double, c_double, c_uint, c_uint]
+CreateOcadWriterSized.restype=c_void_p
+OpenOcadWriter=getattr(lib, "OpenOcadWriter")
+OpenOcadWriter.argtypes=[c_char_p]
+OpenOcadWriter.restype=c_void_p
+MergeOcadFiles=getattr(lib, "MergeOcadFiles")
+MergeOcadFiles.argtypes=[c_char_p, POINTER(c_char_p), c_uint]
 CleanWriter=getattr(lib, "CleanWriter")
 CleanWriter.argtypes=[c_void_p]
 
@@ -23,4 +31,114 @@ AddAreaSymbol.argtypes=[c_void_p,c_char_p, c_int, c_int]
 AddColor=getattr(lib, "AddColor")
 AddColor.argtypes=[c_void_p,c_char_p]
 ExportArea=getattr(lib, "ExportArea") 
+ExportAreas=getattr(lib, "ExportAreas")
+ExportAreas.argtypes=[c_void_p, POINTER(POINT), POINTER(c_uint), POINTER(c_int), c_uint]
+ExportAreaRings=getattr(lib, "ExportAreaRings")
+ExportAreaRings.argtypes=[c_void_p, POINTER(POINT), POINTER(c_uint), c_uint, c_int]
+ExportAreaRingsWorld=getattr(lib, "ExportAreaRingsWorld")
+ExportAreaRingsWorld.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), POINTER(c_uint), c_uint, c_int]
+ExportAreaWorld=getattr(lib, "ExportAreaWorld")
+ExportAreaWorld.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), c_uint, c_int]
+ExportAreasWorld=getattr(lib, "ExportAreasWorld")
+ExportAreasWorld.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), POINTER(c_uint), POINTER(c_int), c_uint]
+AddLineSymbol=getattr(lib, "AddLineSymbol")
+AddLineSymbol.argtypes=[c_void_p, c_char_p, c_int, c_int, c_int]
+ExportLine=getattr(lib, "ExportLine")
+ExportLine.argtypes=[c_void_p, POINTER(POINT), c_uint, c_int]
+ExportLines=getattr(lib, "ExportLines")
+ExportLines.argtypes=[c_void_p, POINTER(POINT), POINTER(c_uint), POINTER(c_int), c_uint]
+ExportLineWorld=getattr(lib, "ExportLineWorld")
+ExportLineWorld.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), c_uint, c_int]
+ExportLinesWorld=getattr(lib, "ExportLinesWorld")
+ExportLinesWorld.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), POINTER(c_uint), POINTER(c_int), c_uint]
+AddPointSymbol=getattr(lib, "AddPointSymbol")
+AddPointSymbol.argtypes=[c_void_p, c_char_p, c_int, c_int, c_int]
+ExportPoints=getattr(lib, "ExportPoints")
+ExportPoints.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), POINTER(c_double), POINTER(c_int), c_uint]
+AddTextSymbol=getattr(lib, "AddTextSymbol")
+AddTextSymbol.argtypes=[c_void_p, c_char_p, c_int, c_int, c_char_p, c_int]
+ExportText=getattr(lib, "ExportText")
+ExportText.argtypes=[c_void_p, c_double, c_double, c_char_p, c_int]
+ExportTextUnicode=getattr(lib, "ExportTextUnicode")
+ExportTextUnicode.argtypes=[c_void_p, c_double, c_double, c_wchar_p, c_int]
+ExportTexts=getattr(lib, "ExportTexts")
+ExportTexts.argtypes=[c_void_p, POINTER(c_double), POINTER(c_double), c_void_p, POINTER(c_uint), POINTER(c_int), c_uint, c_int]
+GetLastHandles=getattr(lib, "GetLastHandles")
+GetLastHandles.argtypes=[c_void_p, POINTER(c_int), c_uint]
+GetLastHandles.restype=c_uint
+ReplaceArea=getattr(lib, "ReplaceArea")
+ReplaceArea.argtypes=[c_void_p, c_int, POINTER(POINT), c_uint, c_int]
+ReplaceLine=getattr(lib, "ReplaceLine")
+ReplaceLine.argtypes=[c_void_p, c_int, POINTER(POINT), c_uint, c_int]
+DeleteObject=getattr(lib, "DeleteObject")
+DeleteObject.argtypes=[c_void_p, c_int]
+SetSimplification=getattr(lib, "SetSimplification")
+SetSimplification.argtypes=[c_void_p, c_int]
+GetRemovedPoints=getattr(lib, "GetRemovedPoints")
+GetRemovedPoints.argtypes=[c_void_p]
+GetRemovedPoints.restype=c_ulonglong
+SetCurveFitting=getattr(lib, "SetCurveFitting")
+SetCurveFitting.argtypes=[c_void_p, c_int]
+SetSplitting=getattr(lib, "SetSplitting")
+SetSplitting.argtypes=[c_void_p, c_int]
+StreamOcadFile=getattr(lib, "StreamOcadFile")
+StreamOcadFile.argtypes=[c_void_p, c_char_p]
 WriteOcadFile=getattr(lib, "WriteOcadFile") 
+
+OpenOcadReader=getattr(lib, "OpenOcadReader")
+OpenOcadReader.argtypes=[c_char_p]
+OpenOcadReader.restype=c_void_p
+CloseOcadReader=getattr(lib, "CloseOcadReader")
+CloseOcadReader.argtypes=[c_void_p]
+SetReaderSymbols=getattr(lib, "SetReaderSymbols")
+SetReaderSymbols.argtypes=[c_void_p, POINTER(c_int), c_uint]
+SetReaderRect=getattr(lib, "SetReaderRect")
+SetReaderRect.argtypes=[c_void_p, c_int, c_int, c_int, c_int]
+GetReaderCounts=getattr(lib, "GetReaderCounts")
+GetReaderCounts.argtypes=[c_void_p, POINTER(c_uint), POINTER(c_uint)]
+ReadOcadObjects=getattr(lib, "ReadOcadObjects")
+ReadOcadObjects.argtypes=[c_void_p, POINTER(c_int), POINTER(c_int), POINTER(c_ushort), POINTER(c_uint), POINTER(c_int), POINTER(c_ubyte)]
+
+OpenOcadRenderer=getattr(lib, "OpenOcadRenderer")
+OpenOcadRenderer.argtypes=[c_char_p, c_uint]
+OpenOcadRenderer.restype=c_void_p
+CloseOcadRenderer=getattr(lib, "CloseOcadRenderer")
+CloseOcadRenderer.argtypes=[c_void_p]
+RenderOcadTile=getattr(lib, "RenderOcadTile")
+RenderOcadTile.argtypes=[c_void_p, c_uint, c_uint, c_uint, POINTER(c_ubyte)]
+RenderOcadTiles=getattr(lib, "RenderOcadTiles")
+RenderOcadTiles.argtypes=[c_void_p, c_char_p, c_uint, c_uint, c_uint, c_int]
+TILES_PPM=0
+TILES_PNG=1
+# flags of ReadObjects: those of x in the low byte, those of y in the high byte
+PY_HOLE=0x200
+
+def ReadObjects(name, symbols=None, rect=None):
+    """Reads the objects of an ocad file, or only those with the given symbols and with bounds
+    overlapping rect (minx, miny, maxx, maxy in map units), into a dict of contiguous arrays: x, y
+    and flags per point, offsets (one more than the objects), symbols and types per object. The
+    arrays are numpy arrays sharing the buffers if numpy is available."""
+    h_reader=OpenOcadReader(name)
+    if not h_reader:
+        raise IOError("can't open " + name)
+    try:
+        if symbols:
+            SetReaderSymbols(h_reader, (c_int*len(symbols))(*symbols), len(symbols))
+        if rect:
+            SetReaderRect(h_reader, *rect)
+        objects=c_uint()
+        points=c_uint()
+        GetReaderCounts(h_reader, byref(objects), byref(points))
+        columns={"x": (c_int*points.value)(), "y": (c_int*points.value)(),
+            "flags": (c_ushort*points.value)(), "offsets": (c_uint*(objects.value+1))(),
+            "symbols": (c_int*objects.value)(), "types": (c_ubyte*objects.value)()}
+        if ReadOcadObjects(h_reader, columns["x"], columns["y"], columns["flags"],
+                columns["offsets"], columns["symbols"], columns["types"]) != 0:
+            raise IOError("can't read " + name)
+    finally:
+        CloseOcadReader(h_reader)
+    try:
+        import numpy
+        return dict((key, numpy.ctypeslib.as_array(value)) for key, value in columns.items())
+    except ImportError:
+        return columns
@@ -1,4 +1,5 @@
 from dllwrapper import *
+import math
 
 class TestPointContainer(unittest.TestCase):
     def setUp(self):
@@ -22,5 +23,341 @@ class TestPointContainer(unittest.TestCase):
         WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\a.ocd"))
         CleanWriter(h_writer)
 
+    def testExportAreas(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+
+        array=((10,100),(100,10),(100,100),(10,10),(50,10),(10,50),(50,50))
+        t=(POINT*len(array))(*array)
+        offsets=(c_uint*3)(0,3,len(array))
+        symbols=(c_int*2)(4100,4100)
+
+        re = ExportAreas(h_writer, t, offsets, symbols, 2)
+        self.assertEqual(re, 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\b.ocd"))
+        CleanWriter(h_writer)
+
+    def testSizedWriter(self):
+        h_writer=CreateOcadWriterSized(c_double(5555000),c_double(4444000), c_double(10000), 1000, 3000)
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+
+        t=(POINT*3)((10,100),(100,10),(100,100))
+        for i in range(1000):
+            self.assertEqual(ExportArea(h_writer, t, 3, 4100), 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\c.ocd"))
+        CleanWriter(h_writer)
+
+    def testStreamFile(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        self.assertEqual(StreamOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\q.ocd")), 0)
+
+        # the objects of the batch go to disk while it is exported, without reserving it up front
+        count=3000
+        array=[(10+i%100,10+i//100) for i in range(count)]*3
+        t=(POINT*len(array))(*array)
+        offsets=(c_uint*(count+1))(*range(0,3*count+1,3))
+        symbols=(c_int*count)(*([4100]*count))
+        self.assertEqual(ExportAreas(h_writer, t, offsets, symbols, count), 0)
+        self.assertEqual(WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\q.ocd")), 0)
+        CleanWriter(h_writer)
+
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\q.ocd")
+        self.assertEqual(len(objects["symbols"]), count)
+        self.assertEqual(objects["offsets"][count], 3*count)
+
+    def testExportAreaRings(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+
+        # outline and a hole, both counterclockwise
+        array=((0,0),(100,0),(100,100),(0,100),(20,20),(80,20),(80,80),(20,80))
+        t=(POINT*len(array))(*array)
+        rings=(c_uint*3)(0,4,len(array))
+        self.assertEqual(ExportAreaRings(h_writer, t, rings, 2, 4100), 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\f.ocd"))
+        CleanWriter(h_writer)
+
+        # the hole is turned clockwise and flagged on its first point
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\f.ocd")
+        self.assertEqual(list(objects["offsets"]), [0,8])
+        self.assertEqual([i for i in range(8) if objects["flags"][i] & PY_HOLE], [4])
+        self.assertEqual((objects["x"][4], objects["y"][4]), (200,800))
+
+    def testExportLines(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        self.assertEqual(AddLineSymbol(h_writer,c_char_p("contour"), 1010, col, 14), 0)
+
+        array=((10,10),(50,20),(100,10),(10,50),(100,50))
+        t=(POINT*len(array))(*array)
+        self.assertEqual(ExportLine(h_writer, t, 3, 1010), 0)
+        offsets=(c_uint*3)(0,3,len(array))
+        symbols=(c_int*2)(1010,1010)
+        self.assertEqual(ExportLines(h_writer, t, offsets, symbols, 2), 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\g.ocd"))
+        CleanWriter(h_writer)
+
+    def testExportPoints(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        self.assertEqual(AddPointSymbol(h_writer,c_char_p("boulder"), 2040, col, 60), 0)
+
+        x=(c_double*3)(5555010.0, 5555020.0, 5555030.0)
+        y=(c_double*3)(4444010.0, 4444020.0, 4444030.0)
+        angles=(c_double*3)(0.0, 45.0, -90.0)
+        symbols=(c_int*3)(2040, 2040, 2040)
+        self.assertEqual(ExportPoints(h_writer, x, y, angles, symbols, 3), 0)
+        self.assertEqual(ExportPoints(h_writer, x, y, None, symbols, 3), 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\h.ocd"))
+        CleanWriter(h_writer)
+
+    def testExportTexts(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        self.assertEqual(AddTextSymbol(h_writer,c_char_p("name"), 7010, col, c_char_p("Arial"), 100), 0)
+
+        self.assertEqual(ExportText(h_writer, 5555010.0, 4444010.0, c_char_p("Lake"), 7010), 0)
+        self.assertEqual(ExportTextUnicode(h_writer, 5555020.0, 4444020.0, c_wchar_p(u"J\u00e4rvi"), 7010), 0)
+
+        text=u"HillSwamp".encode("utf-16-le")
+        x=(c_double*2)(5555030.0, 5555040.0)
+        y=(c_double*2)(4444030.0, 4444040.0)
+        offsets=(c_uint*3)(0,4,9)
+        symbols=(c_int*2)(7010, 7010)
+        self.assertEqual(ExportTexts(h_writer, x, y, text, offsets, symbols, 2, 1), 0)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\i.ocd"))
+        CleanWriter(h_writer)
+
+    def testExportAreaWorld(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+
+        x=(c_double*3)(5555010.0, 5555100.0, 5555100.0)
+        y=(c_double*3)(4444100.0, 4444010.0, 4444100.0)
+        self.assertEqual(ExportAreaWorld(h_writer, x, y, 3, 4100), 0)
+
+        # far outside of the map
+        x[0]=1e12
+        self.assertEqual(ExportAreaWorld(h_writer, x, y, 3, 4100), -1)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\d.ocd"))
+        CleanWriter(h_writer)
+
+    def testSimplification(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym1=AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        SetSimplification(h_writer, 50)
+
+        # a duplicate and two points on the straight edges
+        array=((10,10),(10,10),(50,10),(100,10),(100,100),(10,100),(10,50),(10,10))
+        t=(POINT*len(array))(*array)
+        self.assertEqual(ExportArea(h_writer, t, len(array), 4100), 0)
+        self.assertEqual(GetRemovedPoints(h_writer), 3)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\e.ocd"))
+        CleanWriter(h_writer)
+
+    def testCurveFitting(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        sym2=AddLineSymbol(h_writer,c_char_p("symtwo"), 5100, col, 20)
+        SetCurveFitting(h_writer, 20)
+
+        # a dense half circle becomes a few curves
+        array=[(int(1000+500*math.cos(math.pi*i/100)), int(1000+500*math.sin(math.pi*i/100))) for i in range(101)]
+        t=(POINT*len(array))(*array)
+        self.assertEqual(ExportLine(h_writer, t, len(array), 5100), 0)
+        self.assertTrue(GetRemovedPoints(h_writer) >= 80)
+
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\k.ocd"))
+        CleanWriter(h_writer)
+
+    def testSplitting(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddLineSymbol(h_writer,c_char_p("symtwo"), 5100, col, 20)
+        array=[(i, 10*(i%2)) for i in range(40000)]
+        t=(POINT*len(array))(*array)
+        self.assertEqual(ExportLine(h_writer, t, len(array), 5100), -1)
+        SetSplitting(h_writer, 1)
+        self.assertEqual(ExportLine(h_writer, t, len(array), 5100), 0)
+        # a straight line simplifies to its end points and needs no split
+        SetSimplification(h_writer, 5)
+        straight=(POINT*40000)(*[(i, 0) for i in range(40000)])
+        SetSplitting(h_writer, 0)
+        self.assertEqual(ExportLine(h_writer, straight, 40000, 5100), 0)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\s.ocd"))
+        CleanWriter(h_writer)
+
+        # the pieces share their end points
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\s.ocd")
+        self.assertEqual(list(objects["offsets"]), [0,32768,40001,40003])
+        self.assertEqual(objects["x"][32767], objects["x"][32768])
+
+    def testReadObjects(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        AddLineSymbol(h_writer,c_char_p("symtwo"), 5100, col, 20)
+        area=(POINT*4)((10,10),(100,10),(100,100),(10,10))
+        self.assertEqual(ExportArea(h_writer, area, 4, 4100), 0)
+        line=(POINT*2)((10,10),(100,100))
+        self.assertEqual(ExportLine(h_writer, line, 2, 5100), 0)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\f.ocd"))
+        CleanWriter(h_writer)
+
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\f.ocd")
+        self.assertEqual(list(objects["offsets"]), [0,4,6])
+        self.assertEqual(list(objects["symbols"]), [4100,5100])
+        self.assertEqual(list(objects["types"]), [3,2])
+        self.assertEqual(objects["x"][1], 1000)
+
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\f.ocd", [5100])
+        self.assertEqual(list(objects["offsets"]), [0,2])
+        self.assertEqual(list(objects["y"]), [100,1000])
+
+    def testReadRect(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        area=(POINT*4)((10,10),(100,10),(100,100),(10,10))
+        self.assertEqual(ExportArea(h_writer, area, 4, 4100), 0)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\o.ocd"))
+        CleanWriter(h_writer)
+
+        # a single object is the root of the spatial index, and is still checked against the rect
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\o.ocd", rect=(2000,2000,3000,3000))
+        self.assertEqual(len(objects["symbols"]), 0)
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\o.ocd", rect=(500,500,600,600))
+        self.assertEqual(list(objects["offsets"]), [0,4])
+
+    def testReplaceObjects(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        AddLineSymbol(h_writer,c_char_p("symtwo"), 5100, col, 20)
+        area=(POINT*4)((10,10),(100,10),(100,100),(10,10))
+        self.assertEqual(ExportArea(h_writer, area, 4, 4100), 0)
+        handles=(c_int*4)()
+        self.assertEqual(GetLastHandles(h_writer, handles, 4), 1)
+        first=handles[0]
+        line=(POINT*2)((10,10),(100,100))
+        self.assertEqual(ExportLine(h_writer, line, 2, 5100), 0)
+        self.assertEqual(GetLastHandles(h_writer, handles, 4), 1)
+        second=handles[0]
+
+        # the larger area moves, the line is gone
+        area=(POINT*5)((20,20),(200,20),(200,200),(20,200),(20,20))
+        self.assertEqual(ReplaceArea(h_writer, first, area, 5, 4100), 0)
+        self.assertEqual(GetLastHandles(h_writer, handles, 4), 1)
+        self.assertEqual(handles[0], first)
+        self.assertEqual(DeleteObject(h_writer, second), 0)
+        self.assertEqual(DeleteObject(h_writer, second), -1)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\l.ocd"))
+        CleanWriter(h_writer)
+
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\l.ocd")
+        self.assertEqual(list(objects["offsets"]), [0,5])
+        self.assertEqual(objects["x"][1], 2000)
+
+    def testUpdateFile(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        t=(POINT*8)((10,10),(100,10),(100,100),(10,10),(20,20),(200,20),(200,200),(20,20))
+        offsets=(c_uint*3)(0,4,8)
+        symbols=(c_int*2)(4100,4100)
+        self.assertEqual(ExportAreas(h_writer, t, offsets, symbols, 2), 0)
+        handles=(c_int*2)()
+        self.assertEqual(GetLastHandles(h_writer, handles, 2), 2)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\m.ocd"))
+        CleanWriter(h_writer)
+
+        # the second area is replaced, and a third one added
+        h_writer=OpenOcadWriter(c_char_p("c:\\projekti\\WriteODLL\\m.ocd"))
+        self.assertTrue(h_writer)
+        area=(POINT*4)((30,30),(300,30),(300,300),(30,30))
+        self.assertEqual(ReplaceArea(h_writer, handles[1], area, 4, 4100), 0)
+        self.assertEqual(ExportArea(h_writer, t, 4, 4100), 0)
+        self.assertEqual(WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\m.ocd")), 0)
+        CleanWriter(h_writer)
+
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\m.ocd")
+        self.assertEqual(list(objects["offsets"]), [0,4,8,12])
+        self.assertEqual(objects["x"][5], 3000)
+
+    def testMergeFiles(self):
+        names=["c:\\projekti\\WriteODLL\\n%d.ocd" % i for i in range(2)]
+        for i in range(2):
+            h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+            col=AddColor(h_writer, c_char_p("some color"))
+            AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+            if i == 1:
+                AddLineSymbol(h_writer,c_char_p("symtwo"), 5100, col, 20)
+                line=(POINT*2)((10,10),(100,100))
+                self.assertEqual(ExportLine(h_writer, line, 2, 5100), 0)
+            area=(POINT*4)((10,10),(100,10),(100,100),(10,10))
+            self.assertEqual(ExportArea(h_writer, area, 4, 4100), 0)
+            WriteOcadFile(h_writer, c_char_p(names[i]))
+            CleanWriter(h_writer)
+
+        sources=(c_char_p*2)(*names)
+        self.assertEqual(MergeOcadFiles(c_char_p("c:\\projekti\\WriteODLL\\n.ocd"), sources, 2), 0)
+        objects=ReadObjects("c:\\projekti\\WriteODLL\\n.ocd")
+        self.assertEqual(list(objects["symbols"]), [4100,5100,4100])
+        # the objects of the sources follow each other unchanged
+        parts=[ReadObjects(name) for name in names]
+        self.assertEqual(list(objects["offsets"]), [0,4,6,10])
+        for key in ("x", "y", "flags"):
+            self.assertEqual(list(objects[key]), list(parts[0][key]) + list(parts[1][key]))
+
+    def testRenderTiles(self):
+        h_writer=CreateOcadWriter(c_double(5555000),c_double(4444000), c_double(10000))
+
+        col=AddColor(h_writer, c_char_p("some color"))
+        AddAreaSymbol(h_writer,c_char_p("symone"), 4100, col)
+        area=(POINT*4)((10,10),(100,10),(100,100),(10,10))
+        self.assertEqual(ExportArea(h_writer, area, 4, 4100), 0)
+        WriteOcadFile(h_writer, c_char_p("c:\\projekti\\WriteODLL\\g.ocd"))
+        CleanWriter(h_writer)
+
+        h_renderer=OpenOcadRenderer(c_char_p("c:\\projekti\\WriteODLL\\g.ocd"), 256)
+        self.assertTrue(h_renderer)
+        rgba=(c_ubyte*(256*256*4))()
+        self.assertEqual(RenderOcadTile(h_renderer, 0, 0, 0, rgba), 0)
+        # the triangle covers the lower right corner of the tile
+        self.assertEqual(rgba[(250*256+250)*4+3], 255)
+        self.assertEqual(rgba[(5*256+5)*4+3], 0)
+        self.assertEqual(RenderOcadTiles(h_renderer, c_char_p("c:\\projekti\\WriteODLL\\tiles"), 0, 2, 0, TILES_PNG), 0)
+        CloseOcadRenderer(h_renderer)
+
 if __name__ == '__main__':
     unittest.main()
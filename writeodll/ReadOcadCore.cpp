@@ -0,0 +1,172 @@
+// ReadOcadCore.cpp : Decodes the objects of an ocad file into arrays.
+//
+#include "stdafx.h"
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include "..\libocad\libocad.h"
+#include "ReadOcadCore.h"
+using namespace std;
+
+class OcadReader:public IOcadReader
+{
+private:
+	// private constructor to allow only factory creation
+	OcadReader() : 
+		file(nullptr),
+		points(0),
+		rect_set(false),
+		scanned(false)
+	{
+	}
+	void scan();
+	void add(const OCADObjectEntry *entry);
+	static bool addEntry(void *param, OCADFile *file, OCADObjectEntry *entry);
+	OCADFile *file;
+	vector<bool> wanted;	// symbols to read, indexed by symbol number; empty to read all
+	vector<dword> objects;	// offsets of the objects to read, valid when scanned
+	unsigned points;		// points of these objects in total
+	OCADRect rect;			// bounds the objects have to overlap, if rect_set
+	bool rect_set;
+	bool scanned;
+public:
+	virtual int setSymbols(const int *symbols, unsigned count);
+	virtual int setRect(int minx, int miny, int maxx, int maxy);
+	virtual unsigned objectCount();
+	virtual unsigned pointCount();
+	virtual int read(int *x, int *y, unsigned short *flags, unsigned *offsets, int *symbols, unsigned char *types);
+	static OcadReader* Factory(const char *name);
+	virtual ~OcadReader();
+};
+OcadReader::~OcadReader()
+{
+	if (file) 
+	{
+		ocad_file_close(file);
+		free(file);
+	}
+}
+
+OcadReader* OcadReader::Factory(const char *name)
+{
+	OcadReader *reader = new OcadReader();
+	int err = ocad_file_open_mapped(&reader->file, name);
+	if (err == OCAD_MMAP_NOT_SUPPORTED) err = ocad_file_open(&reader->file, name);
+	if (err != 0 || reader->file->size < sizeof(OCADFileHeader))
+	{
+		delete reader;
+		return nullptr;
+	}
+	return reader;
+}
+
+IOcadReader* OcadReaderFactory(const char *name)
+{
+	return OcadReader::Factory(name);
+}
+
+int OcadReader::setSymbols(const int *symbols, unsigned count)
+{
+	// an invalid symbol leaves the filter as it was
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (symbols[i] < 0 || symbols[i] > 0xFFFF) return -1;
+	}
+	wanted.clear();
+	if (count > 0) wanted.resize(0x10000, false);
+	for (unsigned i = 0; i < count; ++i) wanted[symbols[i]] = true;
+	scanned = false;
+	return 0;
+}
+
+int OcadReader::setRect(int minx, int miny, int maxx, int maxy)
+{
+	rect_set = minx <= maxx;
+	if (rect_set)
+	{
+		if (miny > maxy) return -1;
+		// like the object coordinates, shifted by 8 bits
+		rect.min.x = minx << 8;
+		rect.min.y = miny << 8;
+		rect.max.x = maxx << 8;
+		rect.max.y = maxy << 8;
+	}
+	scanned = false;
+	return 0;
+}
+
+void OcadReader::add(const OCADObjectEntry *entry)
+{
+	// The symbol of the index entry decides, so only the objects which are read are touched
+	if (entry->ptr == 0 || entry->symbol == 0) return;
+	if (!wanted.empty() && !wanted[entry->symbol]) return;
+	if (entry->ptr > file->size - sizeof(OCADObject)) return;
+	OCADObject *object = (OCADObject *)(file->buffer + entry->ptr);
+	if (ocad_object_size(object) > file->size - entry->ptr) return; // damaged file
+	objects.push_back(entry->ptr);
+	points += object->npts;
+}
+
+bool OcadReader::addEntry(void *param, OCADFile * /*file*/, OCADObjectEntry *entry)
+{
+	((OcadReader *)param)->add(entry);
+	return true;
+}
+
+void OcadReader::scan()
+{
+	objects.clear();
+	points = 0;
+	if (rect_set)
+	{
+		if (!ocad_spatial_iterate(file, &rect, addEntry, this))
+		{
+			// no memory for the index
+			objects.clear();
+			points = 0;
+		}
+	}
+	else
+	{
+		for (OCADObjectIndex *idx = ocad_objidx_first(file); idx != NULL; idx = ocad_objidx_next(file, idx))
+		{
+			for (int i = 0; i < 256; ++i) add(&idx->entry[i]);
+		}
+	}
+	scanned = true;
+}
+
+unsigned OcadReader::objectCount()
+{
+	if (!scanned) scan();
+	return (unsigned)objects.size();
+}
+
+unsigned OcadReader::pointCount()
+{
+	if (!scanned) scan();
+	return points;
+}
+
+int OcadReader::read(int *x, int *y, unsigned short *flags, unsigned *offsets, int *symbols, unsigned char *types)
+{
+	if (offsets == nullptr) return -1;
+	if (!scanned) scan();
+	unsigned k = 0;
+	for (size_t i = 0; i < objects.size(); ++i)
+	{
+		const OCADObject *object = (const OCADObject *)(file->buffer + objects[i]);
+		offsets[i] = k;
+		if (symbols) symbols[i] = object->symbol;
+		if (types) types[i] = object->type;
+		const OCADPoint *pts = object->pts;
+		unsigned n = object->npts;
+		// The coordinates are stored shifted by 8 bits, with the flags in the low byte
+		if (x) for (unsigned j = 0; j < n; ++j) x[k + j] = pts[j].x >> 8;
+		if (y) for (unsigned j = 0; j < n; ++j) y[k + j] = pts[j].y >> 8;
+		if (flags) for (unsigned j = 0; j < n; ++j) flags[k + j] = (unsigned short)((pts[j].x & 0xFF) | (pts[j].y & 0xFF) << 8);
+		k += n;
+	}
+	offsets[objects.size()] = k;
+	return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+class IOcadReader
+{
+public:
+	virtual ~IOcadReader() {}
+	// restricts the objects read to the count symbols given, encoded like 4100 == 410.0 in ocad;
+	// with count 0 all objects are read again. Returns -1 and keeps the previous filter if a symbol
+	// is out of range.
+	virtual int setSymbols(const int *symbols, unsigned count) = 0;
+	// restricts the objects read to those whose bounds overlap the rectangle in map units of 0.01 mm,
+	// found through the spatial index; they are read in its order then. With minx > maxx all objects
+	// are read again.
+	virtual int setRect(int minx, int miny, int maxx, int maxy) = 0;
+	// returns the number of objects which are read, and their points in total
+	virtual unsigned objectCount() = 0;
+	virtual unsigned pointCount() = 0;
+	// decodes the objects into arrays sized with objectCount and pointCount. The points of object i
+	// are x[offsets[i]] .. x[offsets[i + 1] - 1], so offsets has objectCount + 1 elements. Coordinates
+	// are in map units of 0.01 mm, and flags holds the flag bits of x in the low byte and those of y
+	// in the high byte. Any of the arrays except offsets may be null to skip it.
+	virtual int read(int *x, int *y, unsigned short *flags, unsigned *offsets, int *symbols, unsigned char *types) = 0;
+};
+// opens an ocad file for reading, memory mapped where possible; returns null if it can't be opened
+IOcadReader* OcadReaderFactory(const char *name);
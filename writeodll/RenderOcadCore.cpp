@@ -0,0 +1,585 @@
+// RenderOcadCore.cpp : Renders the objects of an ocad file into raster tiles.
+//
+#include "stdafx.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "..\libocad\libocad.h"
+#include "RenderOcadCore.h"
+using namespace std;
+
+// Edge of a polygon in pixel coordinates, with y0 < y1
+struct Edge
+{
+	double x0, y0, x1, y1;
+};
+
+static bool edgeAbove(const Edge &a, const Edge &b)
+{
+	return a.y0 < b.y0;
+}
+
+// RGBA image of size x size pixels
+class Raster
+{
+public:
+	Raster(unsigned _size) : size(_size), rgba(4 * _size * _size) {}
+	void clear() { memset(&rgba[0], 0, rgba.size()); }
+	// fills the polygon made of the edges with the even-odd rule, sampling at the pixel centers
+	void fillPolygon(vector<Edge> &edges, const unsigned char *rgb);
+	unsigned size;
+	vector<unsigned char> rgba;
+};
+
+void Raster::fillPolygon(vector<Edge> &edges, const unsigned char *rgb)
+{
+	if (edges.empty()) return;
+	sort(edges.begin(), edges.end(), edgeAbove);
+	double ymax = edges[0].y1;
+	for (size_t i = 1; i < edges.size(); ++i) if (edges[i].y1 > ymax) ymax = edges[i].y1;
+
+	int row = (int)ceil(edges[0].y0 - 0.5);
+	int last = (int)ceil(ymax - 0.5);
+	if (row < 0) row = 0;
+	if (last > (int)size) last = size;
+	vector<const Edge *> active;
+	vector<double> xs;
+	size_t next = 0;
+	for (; row < last; ++row)
+	{
+		double yc = row + 0.5;
+		while (next < edges.size() && edges[next].y0 <= yc) active.push_back(&edges[next++]);
+		xs.clear();
+		for (size_t i = 0; i < active.size(); )
+		{
+			const Edge *e = active[i];
+			if (e->y1 <= yc)
+			{
+				active[i] = active.back();
+				active.pop_back();
+				continue;
+			}
+			xs.push_back(e->x0 + (yc - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0));
+			++i;
+		}
+		sort(xs.begin(), xs.end());
+		unsigned char *line = &rgba[4 * size * row];
+		for (size_t i = 0; i + 1 < xs.size(); i += 2)
+		{
+			double a = ceil(xs[i] - 0.5), b = ceil(xs[i + 1] - 0.5);
+			int from = a < 0 ? 0 : (a > size ? size : (int)a);
+			int to = b < 0 ? 0 : (b > size ? size : (int)b);
+			for (int c = from; c < to; ++c)
+			{
+				line[4 * c] = rgb[0];
+				line[4 * c + 1] = rgb[1];
+				line[4 * c + 2] = rgb[2];
+				line[4 * c + 3] = 255;
+			}
+		}
+	}
+}
+
+// Paints the objects of one tile, as callback of ocad_paint
+class TilePainter
+{
+public:
+	TilePainter(Raster &_raster) : raster(_raster), color(-1) {}
+	void setTile(double _minx, double _maxy, double _scale) { minx = _minx; maxy = _maxy; scale = _scale; }
+	static void setColor(void *param, OCADFile *file, OCADColor *color);
+	static void setSymbol(void *param, OCADFile *file, s16 number, OCADSymbol *symbol);
+	static bool paintObject(void *param, OCADFile *file, s16 number, OCADSymbol *symbol, OCADObject *object);
+private:
+	static bool pathSegment(void *param, SegmentType type, s32 *pt);
+	void addPoint(double x, double y);
+	void collectPath(const OCADObject *object);
+	void fillPath();
+	void strokePath(double width);
+	void fillCircle(double x, double y, double radius);
+	void fillRing(const double *pts, unsigned count);
+	Raster &raster;
+	double minx, maxy, scale;		// map units of the top left corner, pixels per map unit
+	int color;						// number of the current color
+	unsigned char rgb[3];
+	vector<double> pts;				// path in pixel coordinates, x and y interleaved
+	vector<unsigned> starts;		// first point of each subpath, and the end
+	vector<Edge> edges;
+};
+
+void TilePainter::setColor(void *param, OCADFile * /*file*/, OCADColor *color)
+{
+	TilePainter *painter = (TilePainter *)param;
+	int rgb[3];
+	ocad_color_to_rgb(color, rgb);
+	painter->color = color->number;
+	for (int i = 0; i < 3; ++i) painter->rgb[i] = (unsigned char)rgb[i];
+}
+
+void TilePainter::setSymbol(void * /*param*/, OCADFile * /*file*/, s16 /*number*/, OCADSymbol * /*symbol*/)
+{
+}
+
+void TilePainter::addPoint(double x, double y)
+{
+	pts.push_back((x - minx) * scale);
+	pts.push_back((maxy - y) * scale);
+}
+
+bool TilePainter::pathSegment(void *param, SegmentType type, s32 *pt)
+{
+	TilePainter *painter = (TilePainter *)param;
+	if (type == MoveTo)
+	{
+		painter->starts.push_back(painter->pts.size() / 2);
+		painter->addPoint(pt[0], pt[1]);
+	}
+	else if (type == SegmentLineTo)
+	{
+		painter->addPoint(pt[0], pt[1]);
+	}
+	else if (type == CurveTo)
+	{
+		// Flatten the Bezier curve from the last point into a few lines
+		size_t n = painter->pts.size();
+		double x0 = painter->minx + painter->pts[n - 2] / painter->scale;
+		double y0 = painter->maxy - painter->pts[n - 1] / painter->scale;
+		const int steps = 8;
+		for (int i = 1; i <= steps; ++i)
+		{
+			double t = (double)i / steps, u = 1 - t;
+			double a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, d = t * t * t;
+			painter->addPoint(a * x0 + b * pt[0] + c * pt[2] + d * pt[4], a * y0 + b * pt[1] + c * pt[3] + d * pt[5]);
+		}
+	}
+	return true;
+}
+
+void TilePainter::collectPath(const OCADObject *object)
+{
+	pts.clear();
+	starts.clear();
+	ocad_path_iterate(object->npts, object->pts, pathSegment, this);
+	starts.push_back(pts.size() / 2);
+}
+
+void TilePainter::fillPath()
+{
+	// Every subpath is closed, the even-odd rule cuts out the holes
+	edges.clear();
+	for (size_t s = 0; s + 1 < starts.size(); ++s)
+	{
+		unsigned first = starts[s], end = starts[s + 1];
+		for (unsigned i = first; i < end; ++i)
+		{
+			unsigned j = (i + 1 < end) ? i + 1 : first;
+			Edge e = { pts[2 * i], pts[2 * i + 1], pts[2 * j], pts[2 * j + 1] };
+			if (e.y0 == e.y1) continue;
+			if (e.y0 > e.y1)
+			{
+				swap(e.x0, e.x1);
+				swap(e.y0, e.y1);
+			}
+			edges.push_back(e);
+		}
+	}
+	raster.fillPolygon(edges, rgb);
+}
+
+void TilePainter::fillRing(const double *ring, unsigned count)
+{
+	edges.clear();
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned j = (i + 1) % count;
+		Edge e = { ring[2 * i], ring[2 * i + 1], ring[2 * j], ring[2 * j + 1] };
+		if (e.y0 == e.y1) continue;
+		if (e.y0 > e.y1)
+		{
+			swap(e.x0, e.x1);
+			swap(e.y0, e.y1);
+		}
+		edges.push_back(e);
+	}
+	raster.fillPolygon(edges, rgb);
+}
+
+void TilePainter::fillCircle(double x, double y, double radius)
+{
+	const int sides = 16;
+	double ring[2 * sides];
+	for (int i = 0; i < sides; ++i)
+	{
+		double a = 2 * 3.14159265358979 * i / sides;
+		ring[2 * i] = x + radius * cos(a);
+		ring[2 * i + 1] = y + radius * sin(a);
+	}
+	fillRing(ring, sides);
+}
+
+void TilePainter::strokePath(double width)
+{
+	// Each segment is a rectangle, and the joints are rounded by circles; lines are at least a pixel wide
+	double half = width * scale / 2;
+	if (half < 0.5) half = 0.5;
+	for (size_t s = 0; s + 1 < starts.size(); ++s)
+	{
+		unsigned first = starts[s], end = starts[s + 1];
+		for (unsigned i = first; i + 1 < end; ++i)
+		{
+			double x0 = pts[2 * i], y0 = pts[2 * i + 1], x1 = pts[2 * i + 2], y1 = pts[2 * i + 3];
+			double dx = x1 - x0, dy = y1 - y0, len = sqrt(dx * dx + dy * dy);
+			if (len == 0) continue;
+			double nx = -dy / len * half, ny = dx / len * half;
+			double quad[8] = { x0 + nx, y0 + ny, x1 + nx, y1 + ny, x1 - nx, y1 - ny, x0 - nx, y0 - ny };
+			fillRing(quad, 4);
+			if (half > 1 && i + 2 < end) fillCircle(x1, y1, half);
+		}
+	}
+}
+
+bool TilePainter::paintObject(void *param, OCADFile * /*file*/, s16 /*number*/, OCADSymbol *symbol, OCADObject *object)
+{
+	TilePainter *painter = (TilePainter *)param;
+	if (symbol == NULL || object->npts == 0) return true;
+	if (symbol->type == OCAD_AREA_SYMBOL && object->type == 3)
+	{
+		OCADAreaSymbol *area = (OCADAreaSymbol *)symbol;
+		if (!area->fill || area->color != painter->color) return true;
+		painter->collectPath(object);
+		painter->fillPath();
+	}
+	else if (symbol->type == OCAD_LINE_SYMBOL && (object->type == 2 || object->type == 3))
+	{
+		OCADLineSymbol *line = (OCADLineSymbol *)symbol;
+		if (line->width <= 0 || line->color != painter->color) return true;
+		painter->collectPath(object);
+		painter->strokePath(line->width);
+	}
+	else if (symbol->type == OCAD_POINT_SYMBOL && object->type == 1)
+	{
+		// Dots and circles don't depend on the angle of the object
+		OCADPointSymbol *point = (OCADPointSymbol *)symbol;
+		double x = (object->pts[0].x >> 8), y = (object->pts[0].y >> 8);
+		OCADPoint *p = point->pts, *end = point->pts + point->ngrp;
+		while (p < end)
+		{
+			OCADSymbolElement *element = (OCADSymbolElement *)p;
+			if (element->color == painter->color && element->npts > 0)
+			{
+				double cx = (x + (element->pts[0].x >> 8) - painter->minx) * painter->scale;
+				double cy = (painter->maxy - y - (element->pts[0].y >> 8)) * painter->scale;
+				double radius = element->diameter * painter->scale / 2;
+				if (element->type == OCAD_DOT_ELEMENT)
+				{
+					painter->fillCircle(cx, cy, radius < 0.5 ? 0.5 : radius);
+				}
+				else if (element->type == OCAD_CIRCLE_ELEMENT)
+				{
+					const int sides = 32;
+					painter->pts.clear();
+					painter->starts.clear();
+					painter->starts.push_back(0);
+					for (int i = 0; i <= sides; ++i)
+					{
+						double a = 2 * 3.14159265358979 * i / sides;
+						painter->pts.push_back(cx + radius * cos(a));
+						painter->pts.push_back(cy + radius * sin(a));
+					}
+					painter->starts.push_back(sides + 1);
+					painter->strokePath(element->width);
+				}
+			}
+			p += 2 + element->npts;
+		}
+	}
+	return true;
+}
+
+// CRC of PNG chunks
+struct CrcTable
+{
+	CrcTable()
+	{
+		for (unsigned n = 0; n < 256; ++n)
+		{
+			unsigned c = n;
+			for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+	}
+	unsigned update(unsigned crc, const unsigned char *data, size_t size) const
+	{
+		for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+	unsigned table[256];
+};
+static const CrcTable crc_table;
+
+static void putBigEndian(vector<unsigned char> &out, unsigned value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static void putChunk(vector<unsigned char> &out, const char *type, const vector<unsigned char> &data)
+{
+	putBigEndian(out, (unsigned)data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	putBigEndian(out, crc_table.update(0xFFFFFFFFu, &out[start], out.size() - start) ^ 0xFFFFFFFFu);
+}
+
+// writes an RGBA PNG, with the image data in stored deflate blocks so no compression library is needed
+static bool writePng(const char *name, const Raster &raster)
+{
+	unsigned size = raster.size;
+	vector<unsigned char> out, chunk;
+	const unsigned char signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	out.insert(out.end(), signature, signature + 8);
+
+	putBigEndian(chunk, size);
+	putBigEndian(chunk, size);
+	chunk.push_back(8);		// bits per channel
+	chunk.push_back(6);		// RGBA
+	chunk.push_back(0);
+	chunk.push_back(0);
+	chunk.push_back(0);
+	putChunk(out, "IHDR", chunk);
+
+	// Rows prefixed with filter type 0
+	vector<unsigned char> raw;
+	raw.reserve((4 * size + 1) * size);
+	for (unsigned row = 0; row < size; ++row)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), raster.rgba.begin() + 4 * size * row, raster.rgba.begin() + 4 * size * (row + 1));
+	}
+	chunk.clear();
+	chunk.push_back(0x78);
+	chunk.push_back(0x01);
+	unsigned a = 1, b = 0;
+	for (size_t pos = 0; pos < raw.size(); )
+	{
+		size_t n = raw.size() - pos;
+		if (n > 65535) n = 65535;
+		chunk.push_back(pos + n == raw.size() ? 1 : 0);
+		chunk.push_back((unsigned char)n);
+		chunk.push_back((unsigned char)(n >> 8));
+		chunk.push_back((unsigned char)~n);
+		chunk.push_back((unsigned char)(~n >> 8));
+		chunk.insert(chunk.end(), raw.begin() + pos, raw.begin() + pos + n);
+		// Adler-32, reduced only every 5552 bytes before the sums can overflow
+		for (size_t i = pos; i < pos + n; )
+		{
+			size_t block_end = (pos + n - i > 5552) ? i + 5552 : pos + n;
+			for (; i < block_end; ++i)
+			{
+				a += raw[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		pos += n;
+	}
+	putBigEndian(chunk, (b << 16) | a);
+	putChunk(out, "IDAT", chunk);
+	chunk.clear();
+	putChunk(out, "IEND", chunk);
+
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) return false;
+	bool ok = fwrite(&out[0], 1, out.size(), f) == out.size();
+	return fclose(f) == 0 && ok;
+}
+
+// writes a binary PPM, transparent pixels are white
+static bool writePpm(const char *name, const Raster &raster)
+{
+	unsigned size = raster.size;
+	vector<unsigned char> rgb(3 * size * size);
+	for (size_t i = 0, n = (size_t)size * size; i < n; ++i)
+	{
+		const unsigned char *p = &raster.rgba[4 * i];
+		for (int k = 0; k < 3; ++k) rgb[3 * i + k] = (unsigned char)((p[k] * p[3] + 255 * (255 - p[3])) / 255);
+	}
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) return false;
+	fprintf(f, "P6\n%u %u\n255\n", size, size);
+	bool ok = fwrite(&rgb[0], 1, rgb.size(), f) == rgb.size();
+	return fclose(f) == 0 && ok;
+}
+
+static void makeDirectory(const string &name)
+{
+#ifdef _WIN32
+	_mkdir(name.c_str());
+#else
+	mkdir(name.c_str(), 0777);
+#endif
+}
+
+class OcadRenderer:public IOcadRenderer
+{
+private:
+	// private constructor to allow only factory creation
+	OcadRenderer(unsigned _tile_size) :
+		file(nullptr),
+		tile_size(_tile_size)
+	{
+		memset(&paint, 0, sizeof(paint));
+	}
+	int Init(const char *name);
+	void render(OCADPaintData *data, Raster &raster, unsigned z, unsigned x, unsigned y);
+	OCADFile *file;
+	OCADPaintData paint;	// paint data of renderTile, so calls must not overlap; workers of renderTiles have their own
+	unsigned tile_size;
+	double originx, originy;	// top left corner of the tile at zoom 0, in map units
+	double side;				// side of the tile at zoom 0, in map units
+public:
+	virtual unsigned tileSize();
+	virtual int renderTile(unsigned z, unsigned x, unsigned y, unsigned char *rgba);
+	virtual int renderTiles(const char *dir, unsigned minzoom, unsigned maxzoom, unsigned threads, int format);
+	static OcadRenderer* Factory(const char *name, unsigned tile_size);
+	virtual ~OcadRenderer();
+};
+OcadRenderer::~OcadRenderer()
+{
+	ocad_paint_data_free(&paint);
+	if (file)
+	{
+		ocad_file_close(file);
+		free(file);
+	}
+}
+
+OcadRenderer* OcadRenderer::Factory(const char *name, unsigned tile_size)
+{
+	if (tile_size == 0) return nullptr;
+	OcadRenderer *renderer = new OcadRenderer(tile_size);
+	if (renderer->Init(name))
+	{
+		delete renderer;
+		return nullptr;
+	}
+	return renderer;
+}
+
+IOcadRenderer* OcadRendererFactory(const char *name, unsigned tile_size)
+{
+	return OcadRenderer::Factory(name, tile_size);
+}
+
+int OcadRenderer::Init(const char *name)
+{
+	int err = ocad_file_open_mapped(&file, name);
+	if (err == OCAD_MMAP_NOT_SUPPORTED) err = ocad_file_open(&file, name);
+	if (err != 0) return -1;
+	// The spatial index and the symbol table are built once here, the threads only query them
+	if (ocad_spatial_build(file) == NULL) return -1;
+	ocad_symbol(file, 0);
+	OCADRect bounds;
+	if (!ocad_file_bounds(file, &bounds)) return -1;
+	double w = (double)(bounds.max.x >> 8) - (bounds.min.x >> 8);
+	double h = (double)(bounds.max.y >> 8) - (bounds.min.y >> 8);
+	side = (w > h ? w : h) + 1;
+	originx = (bounds.min.x >> 8) + (w - side) / 2;
+	originy = (bounds.max.y >> 8) + (side - h) / 2;
+	if (ocad_paint_data_init(file, &paint) != 0) return -1;
+	return 0;
+}
+
+unsigned OcadRenderer::tileSize()
+{
+	return tile_size;
+}
+
+void OcadRenderer::render(OCADPaintData *data, Raster &raster, unsigned z, unsigned x, unsigned y)
+{
+	double tile = side / (1u << z);
+	double minx = originx + x * tile, maxy = originy - y * tile;
+	OCADRect rect;
+	rect.min.x = (s32)floor(minx) << 8;
+	rect.min.y = (s32)floor(maxy - tile) << 8;
+	rect.max.x = (s32)ceil(minx + tile) << 8;
+	rect.max.y = (s32)ceil(maxy) << 8;
+
+	TilePainter painter(raster);
+	painter.setTile(minx, maxy, tile_size / tile);
+	OCADPaintCallback callback = { TilePainter::setColor, TilePainter::setSymbol, TilePainter::paintObject };
+	raster.clear();
+	ocad_paint_data_fill(data, &rect);
+	ocad_paint(data, &callback, &painter);
+}
+
+int OcadRenderer::renderTile(unsigned z, unsigned x, unsigned y, unsigned char *rgba)
+{
+	if (z > 24 || x >= (1u << z) || y >= (1u << z)) return -1;
+	Raster raster(tile_size);
+	render(&paint, raster, z, x, y);
+	memcpy(rgba, &raster.rgba[0], raster.rgba.size());
+	return 0;
+}
+
+int OcadRenderer::renderTiles(const char *dir, unsigned minzoom, unsigned maxzoom, unsigned threads, int format)
+{
+	if (maxzoom < minzoom || maxzoom > 24) return -1;
+	if (format != OCAD_TILES_PPM && format != OCAD_TILES_PNG) return -1;
+	if (threads == 0) threads = thread::hardware_concurrency();
+	if (threads == 0) threads = 1;
+
+	// The directories are made up front, so the workers only write files
+	string base(dir);
+	makeDirectory(base);
+	unsigned long long total = 0;
+	for (unsigned z = minzoom; z <= maxzoom; ++z)
+	{
+		string zdir = base + "/" + to_string(z);
+		makeDirectory(zdir);
+		for (unsigned x = 0; x < (1u << z); ++x) makeDirectory(zdir + "/" + to_string(x));
+		total += 1ull << (2 * z);
+	}
+
+	// Workers take the next tile until all are done; tiles are independent, so they need no locking
+	atomic<unsigned long long> next(0);
+	atomic<int> failed(0);
+	const char *extension = format == OCAD_TILES_PNG ? ".png" : ".ppm";
+	auto work = [&]()
+	{
+		OCADPaintData data;
+		if (ocad_paint_data_init(file, &data) != 0) { failed = 1; return; }
+		Raster raster(tile_size);
+		for (unsigned long long k = next++; k < total && !failed; k = next++)
+		{
+			// Tile k counts through the levels, and row by row within a level
+			unsigned long long i = k;
+			unsigned z = minzoom;
+			while (i >= (1ull << (2 * z))) i -= 1ull << (2 * z++);
+			unsigned x = (unsigned)(i >> z), y = (unsigned)(i & ((1ull << z) - 1));
+			render(&data, raster, z, x, y);
+			string name = base + "/" + to_string(z) + "/" + to_string(x) + "/" + to_string(y) + extension;
+			bool ok = format == OCAD_TILES_PNG ? writePng(name.c_str(), raster) : writePpm(name.c_str(), raster);
+			if (!ok) failed = 1;
+		}
+		ocad_paint_data_free(&data);
+	};
+	vector<thread> pool;
+	for (unsigned i = 1; i < threads; ++i) pool.push_back(thread(work));
+	work();
+	for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+	return failed ? -1 : 0;
+}
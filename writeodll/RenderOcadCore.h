@@ -0,0 +1,23 @@
+#pragma once
+
+#define OCAD_TILES_PPM 0
+#define OCAD_TILES_PNG 1
+
+class IOcadRenderer
+{
+public:
+	virtual ~IOcadRenderer() {}
+	// the tiles cover a square around all objects: zoom level z has 2^z x 2^z tiles of tile_size pixels,
+	// x counting from west to east and y from north to south
+	virtual unsigned tileSize() = 0;
+	// renders the tile z/x/y into rgba, which holds tile_size * tile_size pixels of 4 bytes, row by row
+	// from the top. Areas, lines and the dots of point symbols are drawn with their symbol colors, the
+	// rest of the tile is transparent. Calls share the paint state of the renderer, so threads calling
+	// this on the same renderer must serialise the calls; renderTiles renders on several threads itself.
+	virtual int renderTile(unsigned z, unsigned x, unsigned y, unsigned char *rgba) = 0;
+	// renders all tiles of the zoom levels minzoom .. maxzoom into dir/z/x/y.ppm or .png files,
+	// using threads threads, or one per processor with 0
+	virtual int renderTiles(const char *dir, unsigned minzoom, unsigned maxzoom, unsigned threads, int format) = 0;
+};
+// opens an ocad file for rendering; returns null if it can't be opened or has no objects
+IOcadRenderer* OcadRendererFactory(const char *name, unsigned tile_size = 256);
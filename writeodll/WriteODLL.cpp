@@ -3,6 +3,8 @@
 
 #include "stdafx.h"
 #include "WriteOcadCore.h"
+#include "ReadOcadCore.h"
+#include "RenderOcadCore.h"
 #include "writeodll.h"
 extern "C"
 {
@@ -10,6 +12,18 @@ extern "C"
 	{
 		return (ExportHandle)OcadWriterFactory(_offsetx, _offsety, _scale);
 	}
+	__declspec(dllexport) ExportHandle __cdecl CreateOcadWriterSized(double _offsetx, double _offsety, double _scale, unsigned coObjects, unsigned coPoints)
+	{
+		return (ExportHandle)OcadWriterFactory(_offsetx, _offsety, _scale, coObjects, coPoints);
+	}
+	__declspec(dllexport) ExportHandle __cdecl OpenOcadWriter(const char * name)
+	{
+		return (ExportHandle)OcadWriterUpdate(name);
+	}
+	__declspec(dllexport) int __cdecl MergeOcadFiles(const char * name, const char ** poSources, unsigned coSources)
+	{
+		return OcadMergeFiles(name, poSources, coSources);
+	}
 	__declspec(dllexport) void __cdecl CleanWriter(ExportHandle ohandle)
 	{
 		IOcadWriter* p = (IOcadWriter*)ohandle;
@@ -28,10 +42,157 @@ extern "C"
 		vector<point> vect(poPoints, poPoints + coPoints);
 		return ((IOcadWriter*)ohandle)->exportArea(vect, symbol);
 	}
+	__declspec(dllexport) int __cdecl ExportAreas(ExportHandle ohandle, const point * poPoints, const unsigned * poOffsets, const int * poSymbols, unsigned coAreas)
+	{
+		return ((IOcadWriter*)ohandle)->exportAreas(poPoints, poOffsets, poSymbols, coAreas);
+	}
+	__declspec(dllexport) int __cdecl ExportAreaRings(ExportHandle ohandle, const point * poPoints, const unsigned * poRings, unsigned coRings, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportAreaRings(poPoints, poRings, coRings, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportAreaRingsWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poRings, unsigned coRings, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportAreaRingsWorld(poX, poY, poRings, coRings, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportAreaWorld(ExportHandle ohandle, const double * poX, const double * poY, unsigned coPoints, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportAreaWorld(poX, poY, coPoints, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportAreasWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poOffsets, const int * poSymbols, unsigned coAreas)
+	{
+		return ((IOcadWriter*)ohandle)->exportAreasWorld(poX, poY, poOffsets, poSymbols, coAreas);
+	}
+	__declspec(dllexport) int __cdecl AddLineSymbol(ExportHandle ohandle, const char *name, int number, int color, int width)
+	{
+		return ((IOcadWriter*)ohandle)->addlinesymbol(name, number, color, width);
+	}
+	__declspec(dllexport) int __cdecl ExportLine(ExportHandle ohandle, const point * poPoints, unsigned coPoints, int symbol)
+	{
+		vector<point> vect(poPoints, poPoints + coPoints);
+		return ((IOcadWriter*)ohandle)->exportLine(vect, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportLines(ExportHandle ohandle, const point * poPoints, const unsigned * poOffsets, const int * poSymbols, unsigned coLines)
+	{
+		return ((IOcadWriter*)ohandle)->exportLines(poPoints, poOffsets, poSymbols, coLines);
+	}
+	__declspec(dllexport) int __cdecl ExportLineWorld(ExportHandle ohandle, const double * poX, const double * poY, unsigned coPoints, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportLineWorld(poX, poY, coPoints, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportLinesWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poOffsets, const int * poSymbols, unsigned coLines)
+	{
+		return ((IOcadWriter*)ohandle)->exportLinesWorld(poX, poY, poOffsets, poSymbols, coLines);
+	}
+	__declspec(dllexport) int __cdecl AddPointSymbol(ExportHandle ohandle, const char *name, int number, int color, int diameter)
+	{
+		return ((IOcadWriter*)ohandle)->addpointsymbol(name, number, color, diameter);
+	}
+	__declspec(dllexport) int __cdecl ExportPoints(ExportHandle ohandle, const double * poX, const double * poY, const double * poAngles, const int * poSymbols, unsigned coPoints)
+	{
+		return ((IOcadWriter*)ohandle)->exportPoints(poX, poY, poAngles, poSymbols, coPoints);
+	}
+	__declspec(dllexport) int __cdecl AddTextSymbol(ExportHandle ohandle, const char *name, int number, int color, const char *font, int size)
+	{
+		return ((IOcadWriter*)ohandle)->addtextsymbol(name, number, color, font, size);
+	}
+	__declspec(dllexport) int __cdecl ExportText(ExportHandle ohandle, double x, double y, const char * text, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportText(x, y, text, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportTextUnicode(ExportHandle ohandle, double x, double y, const unsigned short * text, int symbol)
+	{
+		return ((IOcadWriter*)ohandle)->exportTextUnicode(x, y, text, symbol);
+	}
+	__declspec(dllexport) int __cdecl ExportTexts(ExportHandle ohandle, const double * poX, const double * poY, const void * poText, const unsigned * poOffsets, const int * poSymbols, unsigned coTexts, int unicode)
+	{
+		return ((IOcadWriter*)ohandle)->exportTexts(poX, poY, poText, poOffsets, poSymbols, coTexts, unicode != 0);
+	}
+	__declspec(dllexport) unsigned __cdecl GetLastHandles(ExportHandle ohandle, int * poHandles, unsigned coHandles)
+	{
+		return ((IOcadWriter*)ohandle)->lastHandles(poHandles, coHandles);
+	}
+	__declspec(dllexport) int __cdecl ReplaceArea(ExportHandle ohandle, int handle, const point * poPoints, unsigned coPoints, int symbol)
+	{
+		vector<point> vect(poPoints, poPoints + coPoints);
+		return ((IOcadWriter*)ohandle)->replaceArea(handle, vect, symbol);
+	}
+	__declspec(dllexport) int __cdecl ReplaceLine(ExportHandle ohandle, int handle, const point * poPoints, unsigned coPoints, int symbol)
+	{
+		vector<point> vect(poPoints, poPoints + coPoints);
+		return ((IOcadWriter*)ohandle)->replaceLine(handle, vect, symbol);
+	}
+	__declspec(dllexport) int __cdecl DeleteObject(ExportHandle ohandle, int handle)
+	{
+		return ((IOcadWriter*)ohandle)->deleteObject(handle);
+	}
+	__declspec(dllexport) int __cdecl SetSimplification(ExportHandle ohandle, int tolerance)
+	{
+		return ((IOcadWriter*)ohandle)->setSimplification(tolerance);
+	}
+	__declspec(dllexport) unsigned long long __cdecl GetRemovedPoints(ExportHandle ohandle)
+	{
+		return ((IOcadWriter*)ohandle)->removedPoints();
+	}
+	__declspec(dllexport) int __cdecl SetCurveFitting(ExportHandle ohandle, int tolerance)
+	{
+		return ((IOcadWriter*)ohandle)->setCurveFitting(tolerance);
+	}
+	__declspec(dllexport) int __cdecl SetSplitting(ExportHandle ohandle, int enable)
+	{
+		return ((IOcadWriter*)ohandle)->setSplitting(enable != 0);
+	}
+	__declspec(dllexport) int __cdecl StreamOcadFile(ExportHandle ohandle, const char * name)
+	{
+		return ((IOcadWriter*)ohandle)->streamFile(name);
+	}
 	__declspec(dllexport) int __cdecl WriteOcadFile(ExportHandle ohandle, const char * name)
 	{
 		return ((IOcadWriter*)ohandle)->writeFile(name);
 	}
+	__declspec(dllexport) ReadHandle __cdecl OpenOcadReader(const char * name)
+	{
+		return (ReadHandle)OcadReaderFactory(name);
+	}
+	__declspec(dllexport) void __cdecl CloseOcadReader(ReadHandle rhandle)
+	{
+		IOcadReader* p = (IOcadReader*)rhandle;
+		delete p;
+	}
+	__declspec(dllexport) int __cdecl SetReaderSymbols(ReadHandle rhandle, const int * poSymbols, unsigned coSymbols)
+	{
+		return ((IOcadReader*)rhandle)->setSymbols(poSymbols, coSymbols);
+	}
+	__declspec(dllexport) int __cdecl SetReaderRect(ReadHandle rhandle, int minx, int miny, int maxx, int maxy)
+	{
+		return ((IOcadReader*)rhandle)->setRect(minx, miny, maxx, maxy);
+	}
+	__declspec(dllexport) int __cdecl GetReaderCounts(ReadHandle rhandle, unsigned * coObjects, unsigned * coPoints)
+	{
+		*coObjects = ((IOcadReader*)rhandle)->objectCount();
+		*coPoints = ((IOcadReader*)rhandle)->pointCount();
+		return 0;
+	}
+	__declspec(dllexport) int __cdecl ReadOcadObjects(ReadHandle rhandle, int * poX, int * poY, unsigned short * poFlags, unsigned * poOffsets, int * poSymbols, unsigned char * poTypes)
+	{
+		return ((IOcadReader*)rhandle)->read(poX, poY, poFlags, poOffsets, poSymbols, poTypes);
+	}
+	__declspec(dllexport) RenderHandle __cdecl OpenOcadRenderer(const char * name, unsigned tile_size)
+	{
+		return (RenderHandle)OcadRendererFactory(name, tile_size);
+	}
+	__declspec(dllexport) void __cdecl CloseOcadRenderer(RenderHandle rhandle)
+	{
+		IOcadRenderer* p = (IOcadRenderer*)rhandle;
+		delete p;
+	}
+	__declspec(dllexport) int __cdecl RenderOcadTile(RenderHandle rhandle, unsigned z, unsigned x, unsigned y, unsigned char * poRgba)
+	{
+		return ((IOcadRenderer*)rhandle)->renderTile(z, x, y, poRgba);
+	}
+	__declspec(dllexport) int __cdecl RenderOcadTiles(RenderHandle rhandle, const char * dir, unsigned minzoom, unsigned maxzoom, unsigned threads, int format)
+	{
+		return ((IOcadRenderer*)rhandle)->renderTiles(dir, minzoom, maxzoom, threads, format);
+	}
 
 }
 #if 0
@@ -5,6 +5,9 @@
 #include <fstream>
 #include <vector>
 #include <set>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 #include "..\libocad\libocad.h"
 #include "WriteOcadCore.h"
 using namespace std;
@@ -21,13 +24,13 @@ bool convertPascalString(const char *str, char *out, unsigned out_len)
 	return true;
 }
 
-u16 exportCoordinates( const vector<point> &points, OCADPoint** buffer )
+u16 exportCoordinates( const point *points, size_t count, OCADPoint** buffer )
 {
 	s16 num_points = 0;
 	bool curve_start = false;
 	bool hole_point = false;
 	bool curve_continue = false;
-	for (size_t i = 0, end = points.size(); i < end; ++i)
+	for (size_t i = 0, end = count; i < end; ++i)
 	{
 		OCADPoint p;
 		p.x = (points[i].x*10)<<8;
@@ -39,6 +42,36 @@ u16 exportCoordinates( const vector<point> &points, OCADPoint** buffer )
 	}
 	return num_points;
 }
+// Returns twice the signed area of a ring of OCADPoints
+s64 ringArea(const OCADPoint *pts, unsigned count)
+{
+	s64 area = 0;
+	if (count == 0) return 0;
+	s32 lx = pts[count - 1].x >> 8, ly = pts[count - 1].y >> 8;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		s32 x = pts[i].x >> 8, y = pts[i].y >> 8;
+		area += (s64)lx * y - (s64)ly * x;
+		lx = x; ly = y;
+	}
+	return area;
+}
+// Makes a ring with the given area a hole of an outline with the area outer: holes have to run
+// against the outline, so that they are holes with both the even-odd and the nonzero fill rule
+void finishHole(OCADPoint *ring, unsigned count, s64 area, s64 outer)
+{
+	if (count == 0) return;
+	if (area != 0 && (area > 0) == (outer > 0))
+	{
+		for (unsigned i = 0, j = count - 1; i < j; ++i, --j)
+		{
+			OCADPoint tmp = ring[i];
+			ring[i] = ring[j];
+			ring[j] = tmp;
+		}
+	}
+	ring[0].y |= PY_HOLE;
+}
 void exportCommonSymbolFields(int number, const char * name, OCADSymbol* ocad_symbol, int size)
 {
 	if (!number) number += 1;
@@ -80,6 +113,60 @@ s16 exportAreaSymbol(const char *name, int number, OCADFile * file, int color)
 	return ocad_symbol->number;
 }
 
+s16 exportLineSymbol(const char *name, int number, OCADFile * file, int color, int width)
+{
+	int data_size = (sizeof(OCADLineSymbol) - sizeof(OCADPoint));
+	OCADLineSymbol* ocad_symbol = (OCADLineSymbol*)ocad_symbol_new(file, data_size);
+	if (ocad_symbol == NULL) return -1;
+	exportCommonSymbolFields(number, name, (OCADSymbol*)ocad_symbol, data_size);
+
+	// Basic settings, a plain solid line
+	ocad_symbol->type = OCAD_LINE_SYMBOL;
+	ocad_symbol->extent = (width + 1) / 2;
+	ocad_symbol->color = color;
+	ocad_symbol->width = width;
+	return ocad_symbol->number;
+}
+
+s16 exportPointSymbol(const char *name, int number, OCADFile * file, int color, int diameter)
+{
+	// a single dot element with one point at the origin
+	int ngrp = 2 + 1;
+	int data_size = (sizeof(OCADPointSymbol) - sizeof(OCADPoint)) + ngrp * sizeof(OCADPoint);
+	OCADPointSymbol* ocad_symbol = (OCADPointSymbol*)ocad_symbol_new(file, data_size);
+	if (ocad_symbol == NULL) return -1;
+	exportCommonSymbolFields(number, name, (OCADSymbol*)ocad_symbol, data_size);
+
+	ocad_symbol->type = OCAD_POINT_SYMBOL;
+	ocad_symbol->extent = (diameter + 1) / 2;
+	ocad_symbol->ngrp = ngrp;
+	OCADSymbolElement* element = (OCADSymbolElement*)ocad_symbol->pts;
+	element->type = OCAD_DOT_ELEMENT;
+	element->color = color;
+	element->diameter = diameter;
+	element->npts = 1;
+	return ocad_symbol->number;
+}
+
+s16 exportTextSymbol(const char *name, int number, OCADFile * file, int color, const char *font, int dpts)
+{
+	int data_size = sizeof(OCADTextSymbol);
+	OCADTextSymbol* ocad_symbol = (OCADTextSymbol*)ocad_symbol_new(file, data_size);
+	if (ocad_symbol == NULL) return -1;
+	exportCommonSymbolFields(number, name, (OCADSymbol*)ocad_symbol, data_size);
+
+	// Basic settings, left aligned regular text
+	ocad_symbol->type = OCAD_TEXT_SYMBOL;
+	ocad_symbol->extent = 0;
+	convertPascalString(font, ocad_symbol->font, 32);
+	ocad_symbol->color = color;
+	ocad_symbol->dpts = dpts;
+	ocad_symbol->bold = 400;
+	ocad_symbol->wspace = 100;
+	ocad_symbol->lspace = 100;
+	return ocad_symbol->number;
+}
+
 class Singleton
 {
 public:
@@ -103,33 +190,85 @@ private:
 		offsetx(_offsetx), 
 		offsety(_offsety), 
 		scale(_scale),
-		colorcount(0)
+		colorcount(0),
+		tolerance(-1),
+		removed(0),
+		curve_tolerance(-1),
+		split(false)
 	{
 		file = nullptr;
 	}
-	int Init();
+	int Init(unsigned expected_objects, unsigned expected_points);
+	int InitUpdate(const char *name);
+	int exportPath(const point *pts, unsigned count, int symbol, int type);
+	int replacePath(int handle, const point *pts, unsigned count, int symbol, int type);
+	int exportPathWorld(const double *x, const double *y, unsigned count, int symbol, int type);
+	int reserveBatch(unsigned nobjects, unsigned npts);
+	int exportPaths(const point *pts, const unsigned *offsets, const int *symbols, unsigned count, int type);
+	int exportPathsWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count, int type);
+	void finishObject(OCADObject *ocad_object, OCADObjectEntry *entry, int symbol, int type, bool reduce = true);
+	int exportObject(const OCADPoint *pts, unsigned count, int symbol, int type, bool reduce);
+	int exportOversized(vector<OCADPoint> &pts, int symbol, int type);
+	int exportSplitArea(const OCADPoint *pts, unsigned count, int symbol);
+	int exportSplitLine(const OCADPoint *pts, unsigned count, int symbol);
+	int exportTextAt(const OCADPoint &anchor, const void *text, unsigned length, bool unicode, int symbol);
+	void exportRings(const point *pts, const unsigned *rings, unsigned nrings, OCADPoint *out);
+	bool exportRingsWorld(const double *x, const double *y, const unsigned *rings, unsigned nrings, OCADPoint *out);
 	OCADFile *file;
 	double offsetx, offsety, scale;
+	Transform world;	// world to map transformation from the setup
 	int colorcount;
+	int tolerance;		// simplification tolerance in map units, negative when disabled
+	unsigned long long removed;	// points removed by simplification and curve fitting
+	int curve_tolerance;	// curve fitting tolerance in map units, negative when disabled
+	vector<OCADPoint> fitted;	// curve fitting output, reused between objects
+	bool split;			// split objects with too many points instead of failing
+	vector<int> handles;	// handles of the objects written by the last export
 public:
 	// adds a color to the file with given name, returns current color value
 	virtual int addcolor(const char *name);
 	// adds area symbol with name and number encoded as 4100 == 410.0 in ocad
 	virtual int addareasymbol(const char *name, int number, int color);
 	virtual int exportArea(const vector<point>&area, int symbol);
+	virtual int exportAreas(const point *pts, const unsigned *offsets, const int *symbols, unsigned count);
+	virtual int exportAreaRings(const point *pts, const unsigned *rings, unsigned nrings, int symbol);
+	virtual int exportAreaWorld(const double *x, const double *y, unsigned count, int symbol);
+	virtual int exportAreaRingsWorld(const double *x, const double *y, const unsigned *rings, unsigned nrings, int symbol);
+	virtual int exportAreasWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count);
+	virtual int addlinesymbol(const char *name, int number, int color, int width);
+	virtual int exportLine(const vector<point>&line, int symbol);
+	virtual int exportLines(const point *pts, const unsigned *offsets, const int *symbols, unsigned count);
+	virtual int exportLineWorld(const double *x, const double *y, unsigned count, int symbol);
+	virtual int exportLinesWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count);
+	virtual int addpointsymbol(const char *name, int number, int color, int diameter);
+	virtual int exportPoints(const double *x, const double *y, const double *angles, const int *symbols, unsigned count);
+	virtual int addtextsymbol(const char *name, int number, int color, const char *font, int size);
+	virtual int exportText(double x, double y, const char *text, int symbol);
+	virtual int exportTextUnicode(double x, double y, const unsigned short *text, int symbol);
+	virtual int exportTexts(const double *x, const double *y, const void *text, const unsigned *offsets, const int *symbols, unsigned count, bool unicode);
+	virtual unsigned lastHandles(int *handles, unsigned max);
+	virtual int replaceArea(int handle, const vector<point>&area, int symbol);
+	virtual int replaceLine(int handle, const vector<point>&line, int symbol);
+	virtual int deleteObject(int handle);
+	virtual int setSimplification(int tolerance);
+	virtual unsigned long long removedPoints();
+	virtual int setCurveFitting(int tolerance);
+	virtual int setSplitting(bool enable);
+	virtual int streamFile(const char * name);
 	virtual int writeFile(const char * name);
-	static OcadWriter* Factory(double _offsetx, double _offsety, double _scale);
+	static OcadWriter* Factory(double _offsetx, double _offsety, double _scale, unsigned expected_objects, unsigned expected_points);
+	static OcadWriter* Update(const char *name);
 	virtual ~OcadWriter();
 };
 OcadWriter::~OcadWriter()
 {
-	ocad_file_close(file);
+	if (file) ocad_file_close(file);
 }
 
-OcadWriter* OcadWriter::Factory(double _offsetx, double _offsety, double _scale)
+OcadWriter* OcadWriter::Factory(double _offsetx, double _offsety, double _scale, unsigned expected_objects, unsigned expected_points)
 {
 	OcadWriter *writer = new OcadWriter(_offsetx, _offsety, _scale);
-	if (writer->Init())
+	if (writer->Init(expected_objects, expected_points))
 	{
 		delete writer;
 		return nullptr;
@@ -137,14 +276,31 @@ OcadWriter* OcadWriter::Factory(double _offsetx, double _offsety, double _scale)
 	return writer;
 }
 
-IOcadWriter* OcadWriterFactory(double _offsetx, double _offsety, double _scale)
+IOcadWriter* OcadWriterFactory(double _offsetx, double _offsety, double _scale, unsigned expected_objects, unsigned expected_points)
 {
-    return OcadWriter::Factory(_offsetx, _offsety, _scale );
+    return OcadWriter::Factory(_offsetx, _offsety, _scale, expected_objects, expected_points );
 }
 
-int OcadWriter::Init()
+OcadWriter* OcadWriter::Update(const char *name)
 {
-	ChkErr( ocad_file_new(&file) );
+	OcadWriter *writer = new OcadWriter(0, 0, 0);
+	if (writer->InitUpdate(name))
+	{
+		delete writer;
+		return nullptr;
+	}
+	return writer;
+}
+
+IOcadWriter* OcadWriterUpdate(const char *name)
+{
+	return OcadWriter::Update(name);
+}
+
+int OcadWriter::Init(unsigned expected_objects, unsigned expected_points)
+{
+	// size the buffer for the expected objects up front, so it doesn't grow while exporting
+	ChkErr( ocad_file_new_reserved(&file, ocad_object_storage_size(expected_objects, expected_points)) );
 	OCADSetup* setup = file->setup;
 	setup->zoom = 10;
 	setup->scale = scale;
@@ -152,6 +308,7 @@ int OcadWriter::Init()
 	setup->offsety = offsety;
 	setup->angle = 0;
 	setup->realcoord = 1; 
+	if (!ocad_setup_map_matrix(file, &world)) return -1;
 
 	// Fill header struct
 	OCADFileHeader* header = file->header;
@@ -162,6 +319,52 @@ int OcadWriter::Init()
 	header->minor = 0;
 	return 0;
 }
+int OcadMergeFiles(const char *name, const char * const *sources, unsigned count)
+{
+	if (count == 0) return -1;
+	// the files are opened into structs allocated here, which a failed open leaves to the caller
+	OCADFile *dest = (OCADFile *)malloc(sizeof(OCADFile));
+	if (dest == nullptr) return -1;
+	if (ocad_file_open(&dest, sources[0]) != 0)
+	{
+		free(dest);
+		return -1;
+	}
+	vector<OCADMergeSource> merge;
+	int err = 0;
+	for (unsigned i = 1; i < count && err == 0; ++i)
+	{
+		OCADMergeSource source = { nullptr, nullptr, nullptr };
+		source.file = (OCADFile *)malloc(sizeof(OCADFile));
+		if (source.file == nullptr) { err = -1; break; }
+		err = ocad_file_open_mapped(&source.file, sources[i]);
+		if (err == OCAD_MMAP_NOT_SUPPORTED) err = ocad_file_open(&source.file, sources[i]);
+		if (err == 0) merge.push_back(source);
+		else free(source.file);
+	}
+	if (err == 0 && !merge.empty()) err = ocad_file_merge(dest, &merge[0], (u32)merge.size());
+	if (err == 0) err = ocad_file_save_as(dest, name);
+	for (unsigned i = 0; i < merge.size(); ++i)
+	{
+		ocad_file_close(merge[i].file);
+		free(merge[i].file);
+	}
+	ocad_file_close(dest);
+	free(dest);
+	return err == 0 ? 0 : -1;
+}
+int OcadWriter::InitUpdate(const char *name)
+{
+	ChkErr( ocad_file_open_update(&file, name) );
+	OCADSetup* setup = file->setup;
+	if (setup == NULL) return -1;
+	offsetx = setup->offsetx;
+	offsety = setup->offsety;
+	scale = setup->scale;
+	if (!ocad_setup_map_matrix(file, &world)) return -1;
+	colorcount = file->header->ncolors;
+	return 0;
+}
 int OcadWriter::addcolor(const char *name)
 {
 	++file->header->ncolors;
@@ -173,6 +376,7 @@ int OcadWriter::addcolor(const char *name)
 	ocad_color->yellow = 100;
 	ocad_color->black = 100;
 	convertPascalString("only color", ocad_color->name, 32);
+	ocad_file_touch(file, ocad_color, sizeof(OCADColor));
 	colorcount++;
 	return colorcount - 1;
 }
@@ -182,27 +386,498 @@ int OcadWriter::addareasymbol(const char *name, int number, int color)
 	if (retnumb != number) return -1;
 	return 0;
 }
+int OcadWriter::addlinesymbol(const char *name, int number, int color, int width)
+{
+	int retnumb = exportLineSymbol(name, number, file, color, width);
+	if (retnumb != number) return -1;
+	return 0;
+}
 int OcadWriter::exportArea(const vector<point>&area, int symbol)
 {
-	OCADObject* ocad_object = ocad_object_alloc(NULL);
-	memset(ocad_object, 0, sizeof(OCADObject) - sizeof(OCADPoint) + 8 * (ocad_object->npts + ocad_object->ntext));
+	handles.clear();
+	return exportPath(area.empty() ? NULL : &area[0], area.size(), symbol, 3);
+}
+int OcadWriter::exportPath(const point *pts, unsigned count, int symbol, int type)
+{
+	if (count > OCAD_MAX_OBJECT_PTS)
+	{
+		vector<OCADPoint> coords(count);
+		OCADPoint* coord_buffer = &coords[0];
+		exportCoordinates(pts, count, &coord_buffer);
+		return exportOversized(coords, symbol, type);
+	}
+
+	// The object is built in place in the file buffer
+	OCADObjectEntry* entry;
+	OCADObject* ocad_object = ocad_object_new(file, count, &entry);
+	if (ocad_object == NULL) return -1;
 
-	// Fill some common entries	of object struct
 	OCADPoint* coord_buffer = ocad_object->pts;
-	ocad_object->npts = exportCoordinates(area, &coord_buffer);
+	ocad_object->npts = exportCoordinates(pts, count, &coord_buffer);
+	finishObject(ocad_object, entry, symbol, type);
+	return 0;
+}
+void OcadWriter::finishObject(OCADObject *ocad_object, OCADObjectEntry *entry, int symbol, int type, bool reduce)
+{
+	if (reduce && curve_tolerance > 0 && ocad_object->npts >= 4)
+	{
+		// fit the dense points before simplification drops them
+		if (fitted.size() < ocad_object->npts) fitted.resize(ocad_object->npts);
+		u32 npts = ocad_path_fit_curves(ocad_object->pts, ocad_object->npts, curve_tolerance, &fitted[0]);
+		memcpy(ocad_object->pts, &fitted[0], npts * sizeof(OCADPoint));
+		removed += ocad_object->npts - npts;
+		ocad_object->npts = npts;
+		ocad_object_trim(file, entry);
+	}
+	if (reduce && tolerance >= 0)
+	{
+		u32 npts = ocad_path_simplify(ocad_object->pts, ocad_object->npts, tolerance);
+		removed += ocad_object->npts - npts;
+		ocad_object->npts = npts;
+		ocad_object_trim(file, entry);
+	}
+
+	// Fill some common entries	of object struct
 	ocad_object->angle = 0;
 
 	ocad_object->symbol = symbol;
-	ocad_object->type = 3;	// Area
+	ocad_object->type = type;	// 2 = line, 3 = area
+	ocad_object_entry_refresh(file, entry, ocad_object);
+	handles.push_back(ocad_object_handle(file, entry));
+}
+int OcadWriter::exportObject(const OCADPoint *pts, unsigned count, int symbol, int type, bool reduce)
+{
+	OCADObjectEntry* entry;
+	OCADObject* ocad_object = ocad_object_new(file, count, &entry);
+	if (ocad_object == NULL) return -1;
+	memcpy(ocad_object->pts, pts, count * sizeof(OCADPoint));
+	finishObject(ocad_object, entry, symbol, type, reduce);
+	return 0;
+}
+int OcadWriter::exportOversized(vector<OCADPoint> &pts, int symbol, int type)
+{
+	// reduce the points the way finishObject does, which may bring the object under the limit
+	unsigned count = pts.size();
+	if (curve_tolerance > 0)
+	{
+		// fitted curves can't be cut apart, so they are only kept when the object needs no split
+		if (fitted.size() < count) fitted.resize(count);
+		u32 npts = ocad_path_fit_curves(&pts[0], count, curve_tolerance, &fitted[0]);
+		if (tolerance >= 0) npts = ocad_path_simplify(&fitted[0], npts, tolerance);
+		if (npts <= OCAD_MAX_OBJECT_PTS)
+		{
+			removed += count - npts;
+			return exportObject(&fitted[0], npts, symbol, type, false);
+		}
+	}
+	if (tolerance >= 0)
+	{
+		count = ocad_path_simplify(&pts[0], count, tolerance);
+		removed += pts.size() - count;
+		if (count <= OCAD_MAX_OBJECT_PTS) return exportObject(&pts[0], count, symbol, type, false);
+	}
+	if (!split) return -1;
+	// the pieces are fitted and simplified on their own
+	if (type == 3) return exportSplitArea(&pts[0], count, symbol);
+	return exportSplitLine(&pts[0], count, symbol);
+}
+int OcadWriter::exportSplitArea(const OCADPoint *pts, unsigned count, int symbol)
+{
+	if (count <= OCAD_MAX_OBJECT_PTS) return exportObject(pts, count, symbol, 3, true);
+
+	// cut across the longer side of the bounds, and split the halves further as needed
+	s32 bounds[4];
+	ocad_path_bounds(bounds, count, pts);
+	int axis = (bounds[2] - bounds[0] >= bounds[3] - bounds[1]) ? 0 : 1;
+	s32 lo = bounds[axis], hi = bounds[axis + 2];
+	if (hi - lo < 2) return -1;	// too many points in too small a space
+	s32 cut = lo + (hi - lo) / 2;
+
+	vector<OCADPoint> half(2 * count);
+	for (int below = 1; below >= 0; --below)
+	{
+		unsigned n = ocad_path_clip(pts, count, axis, cut, below != 0, &half[0]);
+		if (n > 0) ChkErr( exportSplitArea(&half[0], n, symbol) );
+	}
+	return 0;
+}
+int OcadWriter::exportSplitLine(const OCADPoint *pts, unsigned count, int symbol)
+{
+	// consecutive pieces share their end points, so the line stays connected
+	for (unsigned start = 0; start + 1 < count; )
+	{
+		unsigned n = min(count - start, (unsigned)OCAD_MAX_OBJECT_PTS);
+		ChkErr( exportObject(pts + start, n, symbol, 2, true) );
+		start += n - 1;
+	}
+	return 0;
+}
+int OcadWriter::exportAreas(const point *pts, const unsigned *offsets, const int *symbols, unsigned count)
+{
+	handles.clear();
+	return exportPaths(pts, offsets, symbols, count, 3);
+}
+int OcadWriter::reserveBatch(unsigned nobjects, unsigned npts)
+{
+	// reserve the whole batch up front, so the file buffer grows at most once. A streaming file only
+	// keeps the objects since the last flush in memory, so a batch mustn't be pinned there at once.
+	if (file->head_size != 0) return 0;
+	return ocad_file_reserve(file, ocad_object_storage_size(nobjects, npts));
+}
+int OcadWriter::exportPaths(const point *pts, const unsigned *offsets, const int *symbols, unsigned count, int type)
+{
+	if (count == 0) return 0;
+	ChkErr( reserveBatch(count, offsets[count] - offsets[0]) );
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		ChkErr( exportPath(pts + offsets[i], offsets[i + 1] - offsets[i], symbols[i], type) );
+	}
+	return 0;
+}
+
+void OcadWriter::exportRings(const point *pts, const unsigned *rings, unsigned nrings, OCADPoint *out)
+{
+	s64 outer = 0;
+	for (unsigned r = 0; r < nrings; ++r)
+	{
+		unsigned count = rings[r + 1] - rings[r];
+		OCADPoint *ring = out + (rings[r] - rings[0]);
+		OCADPoint *coord_buffer = ring;
+		exportCoordinates(pts + rings[r], count, &coord_buffer);
+		s64 area = ringArea(ring, count);
+		if (r == 0) outer = area;
+		else finishHole(ring, count, area, outer);
+	}
+}
+bool OcadWriter::exportRingsWorld(const double *x, const double *y, const unsigned *rings, unsigned nrings, OCADPoint *out)
+{
+	s64 outer = 0;
+	for (unsigned r = 0; r < nrings; ++r)
+	{
+		unsigned count = rings[r + 1] - rings[r];
+		OCADPoint *ring = out + (rings[r] - rings[0]);
+		if (!ocad_path_from_world(&world, x + rings[r], y + rings[r], ring, count)) return false;
+		s64 area = ringArea(ring, count);
+		if (r == 0) outer = area;
+		else finishHole(ring, count, area, outer);
+	}
+	return true;
+}
+int OcadWriter::exportAreaRings(const point *pts, const unsigned *rings, unsigned nrings, int symbol)
+{
+	handles.clear();
+	if (nrings == 0) return -1;
+	unsigned count = rings[nrings] - rings[0];
+	if (count > OCAD_MAX_OBJECT_PTS)
+	{
+		vector<OCADPoint> coords(count);
+		exportRings(pts, rings, nrings, &coords[0]);
+		return exportOversized(coords, symbol, 3);
+	}
+
+	OCADObjectEntry* entry;
+	OCADObject* ocad_object = ocad_object_new(file, count, &entry);
+	if (ocad_object == NULL) return -1;
+	exportRings(pts, rings, nrings, ocad_object->pts);
+	finishObject(ocad_object, entry, symbol, 3);
+	return 0;
+}
+int OcadWriter::exportAreaRingsWorld(const double *x, const double *y, const unsigned *rings, unsigned nrings, int symbol)
+{
+	handles.clear();
+	if (nrings == 0) return -1;
+	unsigned count = rings[nrings] - rings[0];
+	if (count > OCAD_MAX_OBJECT_PTS)
+	{
+		vector<OCADPoint> coords(count);
+		if (!exportRingsWorld(x, y, rings, nrings, &coords[0])) return -1;
+		return exportOversized(coords, symbol, 3);
+	}
+
+	OCADObjectEntry* entry;
+	OCADObject* ocad_object = ocad_object_new(file, count, &entry);
+	if (ocad_object == NULL) return -1;
+	if (!exportRingsWorld(x, y, rings, nrings, ocad_object->pts))
+	{
+		// a coordinate is outside of the map, drop the object again
+		ocad_object_remove(file, entry);
+		return -1;
+	}
+	finishObject(ocad_object, entry, symbol, 3);
+	return 0;
+}
+int OcadWriter::exportAreaWorld(const double *x, const double *y, unsigned count, int symbol)
+{
+	handles.clear();
+	return exportPathWorld(x, y, count, symbol, 3);
+}
+int OcadWriter::exportPathWorld(const double *x, const double *y, unsigned count, int symbol, int type)
+{
+	if (count > OCAD_MAX_OBJECT_PTS)
+	{
+		vector<OCADPoint> coords(count);
+		if (!ocad_path_from_world(&world, x, y, &coords[0], count)) return -1;
+		return exportOversized(coords, symbol, type);
+	}
+
+	OCADObjectEntry* entry;
+	OCADObject* ocad_object = ocad_object_new(file, count, &entry);
+	if (ocad_object == NULL) return -1;
+	if (!ocad_path_from_world(&world, x, y, ocad_object->pts, count))
+	{
+		// a coordinate is outside of the map, drop the object again
+		ocad_object_remove(file, entry);
+		return -1;
+	}
+	finishObject(ocad_object, entry, symbol, type);
+	return 0;
+}
+int OcadWriter::exportAreasWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count)
+{
+	handles.clear();
+	return exportPathsWorld(x, y, offsets, symbols, count, 3);
+}
+int OcadWriter::exportPathsWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count, int type)
+{
+	if (count == 0) return 0;
+	ChkErr( reserveBatch(count, offsets[count] - offsets[0]) );
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		ChkErr( exportPathWorld(x + offsets[i], y + offsets[i], offsets[i + 1] - offsets[i], symbols[i], type) );
+	}
+	return 0;
+}
+
+int OcadWriter::exportLine(const vector<point>&line, int symbol)
+{
+	handles.clear();
+	return exportPath(line.empty() ? NULL : &line[0], line.size(), symbol, 2);
+}
+int OcadWriter::exportLines(const point *pts, const unsigned *offsets, const int *symbols, unsigned count)
+{
+	handles.clear();
+	return exportPaths(pts, offsets, symbols, count, 2);
+}
+int OcadWriter::exportLineWorld(const double *x, const double *y, unsigned count, int symbol)
+{
+	handles.clear();
+	return exportPathWorld(x, y, count, symbol, 2);
+}
+int OcadWriter::exportLinesWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count)
+{
+	handles.clear();
+	return exportPathsWorld(x, y, offsets, symbols, count, 2);
+}
+
+int OcadWriter::addpointsymbol(const char *name, int number, int color, int diameter)
+{
+	int retnumb = exportPointSymbol(name, number, file, color, diameter);
+	if (retnumb != number) return -1;
+	return 0;
+}
+int OcadWriter::exportPoints(const double *x, const double *y, const double *angles, const int *symbols, unsigned count)
+{
+	handles.clear();
+	if (count == 0) return 0;
+	ChkErr( reserveBatch(count, count) );
+
+	// The coordinates are converted a block at a time, and each object is written with its index
+	// entry directly: a point's bounds are the point grown by the symbol extent.
+	const unsigned block = 256;
+	OCADPoint pts[block];
+	int last_symbol = -1;
+	s32 extent = 0;
+	for (unsigned base = 0; base < count; base += block)
+	{
+		unsigned n = min(count - base, block);
+		if (!ocad_path_from_world(&world, x + base, y + base, pts, n)) return -1;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			OCADObjectEntry* entry;
+			OCADObject* ocad_object = ocad_object_new(file, 1, &entry);
+			if (ocad_object == NULL) return -1;
+			int symbol = symbols[base + i];
+			if (symbol != last_symbol)
+			{
+				OCADSymbol *point_symbol = ocad_symbol(file, symbol);
+				extent = point_symbol ? point_symbol->extent : 0;
+				last_symbol = symbol;
+			}
+			if (angles)
+			{
+				double angle = fmod(angles[base + i], 360.0);
+				if (angle < 0) angle += 360.0;
+				ocad_object->angle = (s16)((int)(angle * 10 + 0.5) % 3600);
+			}
+			ocad_object->symbol = symbol;
+			ocad_object->type = 1;	// Point
+			ocad_object->pts[0] = pts[i];
+			entry->rect.min = pts[i];
+			entry->rect.max = pts[i];
+			ocad_rect_grow(&entry->rect, extent);
+			entry->symbol = symbol;
+			handles.push_back(ocad_object_handle(file, entry));
+		}
+	}
+	return 0;
+}
+
+int OcadWriter::addtextsymbol(const char *name, int number, int color, const char *font, int size)
+{
+	int retnumb = exportTextSymbol(name, number, file, color, font, size);
+	if (retnumb != number) return -1;
+	return 0;
+}
+int OcadWriter::exportTextAt(const OCADPoint &anchor, const void *text, unsigned length, bool unicode, int symbol)
+{
+	// The text follows the anchor point in 8 byte groups, including the terminating zero
+	unsigned char_size = unicode ? 2 : 1;
+	unsigned bytes = (length + 1) * char_size;
+	unsigned ntext = (bytes + sizeof(OCADPoint) - 1) / sizeof(OCADPoint);
+	if (1 + ntext > OCAD_MAX_OBJECT_PTS) return -1;
+
 	OCADObjectEntry* entry;
-	ocad_object_add(file, ocad_object, &entry);
-	entry->npts = ocad_object->npts + ocad_object->ntext;
-	free(ocad_object); 
+	OCADObject* ocad_object = ocad_object_new(file, 1 + ntext, &entry);
+	if (ocad_object == NULL) return -1;
+	ocad_object->npts = 1;
+	ocad_object->ntext = ntext;
+	ocad_object->unicode = unicode ? 1 : 0;
+	ocad_object->symbol = symbol;
+	ocad_object->type = 4;	// Text
+	ocad_object->pts[0] = anchor;
+	u8 *dest = (u8 *)(ocad_object->pts + 1);
+	memcpy(dest, text, length * char_size);
+	memset(dest + length * char_size, 0, ntext * sizeof(OCADPoint) - length * char_size);
+
+	// Estimate the bounds of a single line of left aligned text: characters are about half as
+	// wide as the font size, which is in decipoints (1 pt = 35.28 map units)
+	OCADTextSymbol *text_symbol = (OCADTextSymbol *)ocad_symbol(file, symbol);
+	s32 height = text_symbol ? (s32)(text_symbol->dpts * 3.528) : 0;
+	entry->rect.min = anchor;
+	entry->rect.max.x = anchor.x + ((height * (s32)length / 2) << 8);
+	entry->rect.max.y = anchor.y + (height << 8);
+	entry->symbol = symbol;
+	handles.push_back(ocad_object_handle(file, entry));
+	return 0;
+}
+int OcadWriter::exportText(double x, double y, const char *text, int symbol)
+{
+	handles.clear();
+	OCADPoint anchor;
+	if (!ocad_path_from_world(&world, &x, &y, &anchor, 1)) return -1;
+	return exportTextAt(anchor, text, strlen(text), false, symbol);
+}
+int OcadWriter::exportTextUnicode(double x, double y, const unsigned short *text, int symbol)
+{
+	handles.clear();
+	OCADPoint anchor;
+	if (!ocad_path_from_world(&world, &x, &y, &anchor, 1)) return -1;
+	unsigned length = 0;
+	while (text[length] != 0) ++length;
+	return exportTextAt(anchor, text, length, true, symbol);
+}
+int OcadWriter::exportTexts(const double *x, const double *y, const void *text, const unsigned *offsets, const int *symbols, unsigned count, bool unicode)
+{
+	handles.clear();
+	if (count == 0) return 0;
+	unsigned char_size = unicode ? 2 : 1;
+	unsigned groups = ((offsets[count] - offsets[0]) * char_size + count * (char_size + sizeof(OCADPoint) - 1)) / sizeof(OCADPoint);
+	ChkErr( reserveBatch(count, count + groups) );
+
+	const unsigned block = 256;
+	OCADPoint anchors[block];
+	for (unsigned base = 0; base < count; base += block)
+	{
+		unsigned n = min(count - base, block);
+		if (!ocad_path_from_world(&world, x + base, y + base, anchors, n)) return -1;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			unsigned k = base + i;
+			const u8 *chars = (const u8 *)text + offsets[k] * char_size;
+			ChkErr( exportTextAt(anchors[i], chars, offsets[k + 1] - offsets[k], unicode, symbols[k]) );
+		}
+	}
+	return 0;
+}
+
+unsigned OcadWriter::lastHandles(int *_handles, unsigned max)
+{
+	unsigned n = min((unsigned)handles.size(), max);
+	if (n > 0) memcpy(_handles, &handles[0], n * sizeof(int));
+	return handles.size();
+}
+int OcadWriter::replaceArea(int handle, const vector<point>&area, int symbol)
+{
+	handles.clear();
+	return replacePath(handle, area.empty() ? NULL : &area[0], area.size(), symbol, 3);
+}
+int OcadWriter::replaceLine(int handle, const vector<point>&line, int symbol)
+{
+	handles.clear();
+	return replacePath(handle, line.empty() ? NULL : &line[0], line.size(), symbol, 2);
+}
+int OcadWriter::replacePath(int handle, const point *pts, unsigned count, int symbol, int type)
+{
+	OCADObjectEntry* entry = ocad_object_entry_by_handle(file, handle);
+	if (entry == NULL || entry->symbol == 0) return -1;
+
+	// the entry keeps its place in the index, only the object may move
+	OCADObject* ocad_object = ocad_object_renew(file, entry, count, &entry);
+	if (ocad_object == NULL) return -1;
+	OCADPoint* coord_buffer = ocad_object->pts;
+	ocad_object->npts = exportCoordinates(pts, count, &coord_buffer);
+	finishObject(ocad_object, entry, symbol, type);
+	return 0;
+}
+int OcadWriter::deleteObject(int handle)
+{
+	OCADObjectEntry* entry = ocad_object_entry_by_handle(file, handle);
+	if (entry == NULL || entry->symbol == 0) return -1;
+	return ocad_object_remove(file, entry);
+}
+
+int OcadWriter::setSimplification(int _tolerance)
+{
+	tolerance = _tolerance;
+	return 0;
+}
+unsigned long long OcadWriter::removedPoints()
+{
+	return removed;
+}
+int OcadWriter::setCurveFitting(int _tolerance)
+{
+	curve_tolerance = _tolerance;
+	return 0;
+}
+int OcadWriter::setSplitting(bool enable)
+{
+	split = enable;
+	return 0;
+}
+
+int OcadWriter::streamFile(const char * name)
+{
+	ChkErr( ocad_file_stream(file, name) );
 	return 0;
 }
 
 int OcadWriter::writeFile(const char * name)
 {
+	if (file->head_size != 0)
+	{
+		// streaming, the rest of the file goes to the stream's file
+		ChkErr( ocad_file_stream_end(file) );
+		return 0;
+	}
+	if (file->update && strcmp(name, file->filename) == 0)
+	{
+		// opened for update, only the changes are written back
+		ChkErr( ocad_file_save(file) );
+		return 0;
+	}
 	ofstream fout(name, ios::out | ios::binary);
 	fout.write((const char*)file->buffer, file->size);
 	return 0;
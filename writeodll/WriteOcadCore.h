@@ -11,12 +11,91 @@ struct point
 class IOcadWriter
 {
 public:
+	virtual ~IOcadWriter() {}
     // adds a color to the file with given name, returns current color value
 	virtual int addcolor(const char *name) = 0;
 	// adds area symbol with name and number encoded as 4100 == 410.0 in ocad
 	virtual int addareasymbol(const char *name, int number, int color) = 0;
 	virtual int exportArea(const vector<point>&area, int symbol) = 0;
+	// exports count areas in one call, area i uses the points pts[offsets[i]] .. pts[offsets[i + 1] - 1]
+	// and symbol symbols[i], so offsets has count + 1 elements
+	virtual int exportAreas(const point *pts, const unsigned *offsets, const int *symbols, unsigned count) = 0;
+	// exports an area with holes: ring i uses the points pts[rings[i]] .. pts[rings[i + 1] - 1], so rings
+	// has nrings + 1 elements. Ring 0 is the outline, all others are holes. Holes are flagged and turned
+	// against the outline as needed, so the rings may come in any orientation.
+	virtual int exportAreaRings(const point *pts, const unsigned *rings, unsigned nrings, int symbol) = 0;
+	// exports an area given in world coordinates, x holding the eastings and y the northings in meters;
+	// they are transformed with the offset and scale of the writer. Fails if a point is outside of the map.
+	virtual int exportAreaWorld(const double *x, const double *y, unsigned count, int symbol) = 0;
+	// exports an area with holes in world coordinates, with rings like exportAreaRings
+	virtual int exportAreaRingsWorld(const double *x, const double *y, const unsigned *rings, unsigned nrings, int symbol) = 0;
+	// exports count areas in world coordinates, with offsets and symbols like exportAreas
+	virtual int exportAreasWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count) = 0;
+	// adds line symbol with name and number like addareasymbol, width is in 0.01 mm
+	virtual int addlinesymbol(const char *name, int number, int color, int width) = 0;
+	// exports a line; lines have the same batched and world coordinate variants as areas
+	virtual int exportLine(const vector<point>&line, int symbol) = 0;
+	virtual int exportLines(const point *pts, const unsigned *offsets, const int *symbols, unsigned count) = 0;
+	virtual int exportLineWorld(const double *x, const double *y, unsigned count, int symbol) = 0;
+	virtual int exportLinesWorld(const double *x, const double *y, const unsigned *offsets, const int *symbols, unsigned count) = 0;
+	// adds point symbol with name and number like addareasymbol: a dot with the diameter in 0.01 mm
+	virtual int addpointsymbol(const char *name, int number, int color, int diameter) = 0;
+	// exports count point objects in world coordinates: point i is at x[i], y[i], rotated by angles[i]
+	// degrees counterclockwise (angles may be NULL) and has symbol symbols[i]. The points are converted
+	// in blocks of 256: if a block has a point outside of the map, returns -1 without writing any point
+	// of that block or after it, while the points of the blocks before stay written.
+	virtual int exportPoints(const double *x, const double *y, const double *angles, const int *symbols, unsigned count) = 0;
+	// adds text symbol with name and number like addareasymbol, using the font with the size in decipoints
+	virtual int addtextsymbol(const char *name, int number, int color, const char *font, int size) = 0;
+	// exports a zero terminated text anchored at the world coordinates x, y (left end of the baseline)
+	virtual int exportText(double x, double y, const char *text, int symbol) = 0;
+	// exports a zero terminated UTF-16 text like exportText
+	virtual int exportTextUnicode(double x, double y, const unsigned short *text, int symbol) = 0;
+	// exports count texts: text i is at x[i], y[i], has symbol symbols[i] and the characters
+	// text[offsets[i]] .. text[offsets[i + 1] - 1], where characters are UTF-16 if unicode is set and
+	// bytes otherwise. The texts in the buffer don't need to be zero terminated.
+	virtual int exportTexts(const double *x, const double *y, const void *text, const unsigned *offsets, const int *symbols, unsigned count, bool unicode) = 0;
+	// every object written by an export has a handle, which stays the same until the writer is deleted.
+	// Copies the handles of the objects written by the last export or replace call into handles, up to
+	// max of them, and returns their number: one for most objects, several for a split one, and one
+	// per object for the batch exports.
+	virtual unsigned lastHandles(int *handles, unsigned max) = 0;
+	// replaces the object with the given handle by an area or a line, keeping the handle. The object is
+	// rewritten in place if the new points fit into its space, and moved otherwise. Objects aren't split
+	// here, and nothing can be replaced or deleted while streaming.
+	virtual int replaceArea(int handle, const vector<point>&area, int symbol) = 0;
+	virtual int replaceLine(int handle, const vector<point>&line, int symbol) = 0;
+	// deletes the object with the given handle; its space and handle are reused by later objects
+	virtual int deleteObject(int handle) = 0;
+	// simplifies exported areas and lines: points repeating the previous one are dropped, and with a tolerance
+	// above 0 (in 0.01 mm on the map) also points closer than it to the simplified outline.
+	// A negative tolerance turns simplification off, which is the default.
+	virtual int setSimplification(int tolerance) = 0;
+	// returns the number of points dropped by simplification and curve fitting so far
+	virtual unsigned long long removedPoints() = 0;
+	// replaces runs of points of exported areas and lines by Bezier curves which stay within tolerance
+	// (in 0.01 mm on the map) of the original points; corners, holes and the ends of rings are kept.
+	// Fitting runs before simplification. A tolerance of 0 or less turns it off, which is the default.
+	virtual int setCurveFitting(int tolerance) = 0;
+	// areas and lines with more than OCAD_MAX_OBJECT_PTS points after curve fitting and simplification
+	// are refused, unless splitting is enabled:
+	// then areas are cut into several areas with the same symbol, which together cover the original one,
+	// and lines into pieces which share their end points
+	virtual int setSplitting(bool enable) = 0;
+	// starts writing the file to name while objects are exported, so memory use stays bounded;
+	// colors and symbols should be added before. writeFile then completes this file.
+	virtual int streamFile(const char * name) = 0;
 	virtual int writeFile(const char * name) = 0;
 };
-IOcadWriter* OcadWriterFactory(double _offsetx, double _offsety, double _scale);
+// expected_objects and expected_points are optional hints on the number of areas and their points
+// in total, used to size the file buffer before the export
+IOcadWriter* OcadWriterFactory(double _offsetx, double _offsety, double _scale, unsigned expected_objects = 0, unsigned expected_points = 0);
+// opens an existing ocad file for changing it with exports, replacements and deletions; its objects keep
+// the handles they got when it was written. Offset, scale and colors come from the file, and writeFile
+// with the same name then writes back only what changed. Returns null if the file can't be opened for writing.
+IOcadWriter* OcadWriterUpdate(const char *name);
+// merges the files written by several writers into name. The first file gives the header, setup, colors
+// and symbols, and the symbols of the others which it doesn't have are added; the objects are copied
+// without decoding them.
+int OcadMergeFiles(const char *name, const char * const *sources, unsigned count);
 #define ChkErr( expr ) { if (expr != 0) { return -1; } }
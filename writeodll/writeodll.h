@@ -1,2 +1,4 @@
 #pragma once
 typedef void* ExportHandle;
+typedef void* ReadHandle;
+typedef void* RenderHandle;
@@ -3,9 +3,47 @@
 extern "C"
 {
 	__declspec(dllimport) ExportHandle __cdecl CreateOcadWriter(double _offsetx, double _offsety, double _scale);
+	__declspec(dllimport) ExportHandle __cdecl CreateOcadWriterSized(double _offsetx, double _offsety, double _scale, unsigned coObjects, unsigned coPoints);
+	__declspec(dllimport) ExportHandle __cdecl OpenOcadWriter(const char * name);
+	__declspec(dllimport) int __cdecl MergeOcadFiles(const char * name, const char ** poSources, unsigned coSources);
     __declspec(dllimport) void __cdecl CleanWriter(ExportHandle ohandle);
 	__declspec(dllimport) int __cdecl AddColor(ExportHandle ohandle, const char *name);
 	__declspec(dllimport) int __cdecl AddAreaSymbol(ExportHandle ohandle, const char *name, int number, int color);
 	__declspec(dllimport) int __cdecl ExportArea(ExportHandle ohandle, const point * poPoints, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl ExportAreas(ExportHandle ohandle, const point * poPoints, const unsigned * poOffsets, const int * poSymbols, unsigned coAreas);
+	__declspec(dllimport) int __cdecl ExportAreaRings(ExportHandle ohandle, const point * poPoints, const unsigned * poRings, unsigned coRings, int symbol);
+	__declspec(dllimport) int __cdecl ExportAreaRingsWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poRings, unsigned coRings, int symbol);
+	__declspec(dllimport) int __cdecl ExportAreaWorld(ExportHandle ohandle, const double * poX, const double * poY, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl ExportAreasWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poOffsets, const int * poSymbols, unsigned coAreas);
+	__declspec(dllimport) int __cdecl AddLineSymbol(ExportHandle ohandle, const char *name, int number, int color, int width);
+	__declspec(dllimport) int __cdecl ExportLine(ExportHandle ohandle, const point * poPoints, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl ExportLines(ExportHandle ohandle, const point * poPoints, const unsigned * poOffsets, const int * poSymbols, unsigned coLines);
+	__declspec(dllimport) int __cdecl ExportLineWorld(ExportHandle ohandle, const double * poX, const double * poY, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl ExportLinesWorld(ExportHandle ohandle, const double * poX, const double * poY, const unsigned * poOffsets, const int * poSymbols, unsigned coLines);
+	__declspec(dllimport) int __cdecl AddPointSymbol(ExportHandle ohandle, const char *name, int number, int color, int diameter);
+	__declspec(dllimport) int __cdecl ExportPoints(ExportHandle ohandle, const double * poX, const double * poY, const double * poAngles, const int * poSymbols, unsigned coPoints);
+	__declspec(dllimport) int __cdecl AddTextSymbol(ExportHandle ohandle, const char *name, int number, int color, const char *font, int size);
+	__declspec(dllimport) int __cdecl ExportText(ExportHandle ohandle, double x, double y, const char * text, int symbol);
+	__declspec(dllimport) int __cdecl ExportTextUnicode(ExportHandle ohandle, double x, double y, const unsigned short * text, int symbol);
+	__declspec(dllimport) int __cdecl ExportTexts(ExportHandle ohandle, const double * poX, const double * poY, const void * poText, const unsigned * poOffsets, const int * poSymbols, unsigned coTexts, int unicode);
+	__declspec(dllimport) unsigned __cdecl GetLastHandles(ExportHandle ohandle, int * poHandles, unsigned coHandles);
+	__declspec(dllimport) int __cdecl ReplaceArea(ExportHandle ohandle, int handle, const point * poPoints, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl ReplaceLine(ExportHandle ohandle, int handle, const point * poPoints, unsigned coPoints, int symbol);
+	__declspec(dllimport) int __cdecl DeleteObject(ExportHandle ohandle, int handle);
+	__declspec(dllimport) int __cdecl SetSimplification(ExportHandle ohandle, int tolerance);
+	__declspec(dllimport) unsigned long long __cdecl GetRemovedPoints(ExportHandle ohandle);
+	__declspec(dllimport) int __cdecl SetCurveFitting(ExportHandle ohandle, int tolerance);
+	__declspec(dllimport) int __cdecl SetSplitting(ExportHandle ohandle, int enable);
+	__declspec(dllimport) int __cdecl StreamOcadFile(ExportHandle ohandle, const char * name);
 	__declspec(dllimport) int __cdecl WriteOcadFile(ExportHandle ohandle, const char * name);
+	__declspec(dllimport) ReadHandle __cdecl OpenOcadReader(const char * name);
+	__declspec(dllimport) void __cdecl CloseOcadReader(ReadHandle rhandle);
+	__declspec(dllimport) int __cdecl SetReaderSymbols(ReadHandle rhandle, const int * poSymbols, unsigned coSymbols);
+	__declspec(dllimport) int __cdecl SetReaderRect(ReadHandle rhandle, int minx, int miny, int maxx, int maxy);
+	__declspec(dllimport) int __cdecl GetReaderCounts(ReadHandle rhandle, unsigned * coObjects, unsigned * coPoints);
+	__declspec(dllimport) int __cdecl ReadOcadObjects(ReadHandle rhandle, int * poX, int * poY, unsigned short * poFlags, unsigned * poOffsets, int * poSymbols, unsigned char * poTypes);
+	__declspec(dllimport) RenderHandle __cdecl OpenOcadRenderer(const char * name, unsigned tile_size);
+	__declspec(dllimport) void __cdecl CloseOcadRenderer(RenderHandle rhandle);
+	__declspec(dllimport) int __cdecl RenderOcadTile(RenderHandle rhandle, unsigned z, unsigned x, unsigned y, unsigned char * poRgba);
+	__declspec(dllimport) int __cdecl RenderOcadTiles(RenderHandle rhandle, const char * dir, unsigned minzoom, unsigned maxzoom, unsigned threads, int format);
 }